@@ -1,4 +1,8 @@
 #include <unistd.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <csignal>
 #include "util.hpp"
 #include "level.hpp"
 #include "formatter.hpp"
@@ -9,6 +13,30 @@
 using namespace std;
 using namespace Log;
 
+// 统计当前线程调用malloc/calloc/realloc的次数, 用于验证日志调用不分配堆内存(仅glibc)
+static thread_local size_t alloc_count = 0;
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *malloc(size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_malloc(size);
+    }
+    void *calloc(size_t n, size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_calloc(n, size);
+    }
+    void *realloc(void *ptr, size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_realloc(ptr, size);
+    }
+}
+
 void testUtil()
 {
     cout << Log::Util::Date::now() << endl;
@@ -37,6 +65,55 @@ void testFormat()
     std::cout << ret;
 }
 
+void testTimeCache()
+{
+    // 缓存的日期字符串与localtime_r+strftime的结果一致
+    Log::LogMessage msg(LogLevel::INFO, 150, "test.cpp", "root", "测试日期缓存");
+    Log::Formatter fmtr("%d{%Y-%m-%d %H:%M:%S %a %j}");
+    time_t t = msg._ctime;
+    struct tm lt;
+    localtime_r(&t, &lt);
+    char expect[128];
+    strftime(expect, sizeof(expect), "%Y-%m-%d %H:%M:%S %a %j", &lt);
+    cout << fmtr.format(msg) << " " << fmtr.format(msg) << " " << expect << endl;
+    // 时区变化后需要显式重新加载
+    setenv("TZ", "UTC", 1);
+    Util::Date::reloadTimezone();
+    msg._ctime += 1;
+    cout << fmtr.format(msg) << endl;
+}
+
+void testClock()
+{
+    // 不同时钟源的时间戳都转换为墙上时间, 日期格式支持毫秒/微秒/纳秒
+    Log::Formatter fmtr("[%d{%H:%M:%S.%3N}][%d{%H:%M:%S.%6N}][%d{%H:%M:%S.%9N}]%T%m%n");
+    Util::ClockSource srcs[] = {Util::CLOCK_SOURCE_REALTIME, Util::CLOCK_SOURCE_REALTIME_COARSE,
+                                Util::CLOCK_SOURCE_MONOTONIC, Util::CLOCK_SOURCE_TSC};
+    for (auto src : srcs)
+    {
+        Util::Clock::setSource(src);
+        Log::LogMessage msg(LogLevel::INFO, 150, "test.cpp", "root", "测试时钟源");
+        cout << fmtr.format(msg);
+    }
+    // 重新校准与读取时间同时进行, 读到的时间始终有效
+    std::atomic<bool> done(false);
+    std::thread recal([&]
+                      { for (int i = 0; i < 5; ++i) Util::Clock::calibrate(); done = true; });
+    size_t bad = 0, reads = 0;
+    while (!done)
+    {
+        size_t sec, nsec;
+        Util::Clock::toWall(Util::CLOCK_SOURCE_TSC, Util::Clock::tick(Util::CLOCK_SOURCE_TSC), sec, nsec);
+        long diff = (long)sec - (long)time(nullptr);
+        if (diff < -1 || diff > 1 || nsec >= 1000000000)
+            ++bad;
+        ++reads;
+    }
+    recal.join();
+    cout << "重新校准期间读取" << reads << "次, 异常" << bad << "次" << endl;
+    Util::Clock::setSource(Util::CLOCK_SOURCE_REALTIME);
+}
+
 // void testOut()
 // {
 //     Log::LogMessage msg(LogLevel::INFO, 150, "test.cpp", "root", "测试输出接口");
@@ -295,6 +372,970 @@ void testAsync2()
     }
 }
 
+void testLockFree()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("LOCKFREE logger");
+    builder->buildLoggerLevel(LogLevel::Level::DEBUG);
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildFormatter();
+    builder->buildLockFreeAsync(64 * 1024);
+    builder->buildOutputType<FileOutput>("./logfile/lockfree.log");
+    auto async_logger = builder->build();
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]
+                             {
+            for (int i = 0; i < 10000; i++)
+            {
+                async_logger->debug("%d-%d-%s", t, i + 1, "测试无锁异步日志器");
+            } });
+    }
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    // 超过环形缓冲区内联长度的记录存放到环外
+    string large(32 * 1024, 'a');
+    async_logger->debug("%s", large.c_str());
+}
+
+void testStaging()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("STAGING logger");
+    builder->buildLoggerLevel(LogLevel::Level::DEBUG);
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildFormatter();
+    builder->buildThreadStaging(4 * 1024, 50);
+    builder->buildOutputType<StdOutput>();
+    auto async_logger = builder->build();
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        // 线程退出时暂存区中剩余的数据会被发布
+        threads.emplace_back([&, t]
+                             {
+            for (int i = 0; i < 1000; i++)
+            {
+                async_logger->debug("%d-%d-%s", t, i + 1, "测试线程暂存区");
+            } });
+    }
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    // 少量数据达不到大小阈值, 由异步线程超时收集
+    async_logger->info("%s", "测试暂存区超时发布");
+    usleep(200 * 1000);
+    // FATAL日志会立即发布
+    async_logger->fatal("%s", "测试暂存区立即发布");
+}
+
+// 格式串不是字符串字面量时依然可以使用日志宏, 每次调用都使用当时的格式串
+void testRuntimeFormat()
+{
+    const char *names[] = {"sync", "deferred"};
+    for (int i = 0; i < 2; ++i)
+    {
+        string path = string("./logfile/runtime_format_") + names[i] + ".log";
+        remove(path.c_str());
+        {
+            std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+            builder->buildLoggerName(string("RUNTIME format ") + names[i]);
+            builder->buildFormatter("%m%n");
+            if (i == 1)
+            {
+                builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+                builder->buildDeferredFormat();
+            }
+            builder->buildOutputType<FileOutput>(path);
+            auto lgr = builder->build();
+            string fmt = "string-%d";
+            lgr->info(fmt, 1);
+            fmt = "changed-%d";
+            lgr->info(fmt, 2);
+            const char *cfmt = i == 0 ? "pointer-%s" : "pointer2-%s";
+            lgr->warning(cfmt, "3");
+            char buf[32];
+            snprintf(buf, sizeof(buf), "array-%%d");
+            lgr->error(buf, 4);
+            lgr->info("literal-%d", 5);
+        }
+        ifstream ifs(path);
+        string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        string expect = string("string-1\nchanged-2\n") + (i == 0 ? "pointer-3\n" : "pointer2-3\n") + "array-4\nliteral-5\n";
+        cout << names[i] << ": 运行时格式串输出" << (content == expect ? "正确" : "错误") << endl;
+    }
+}
+
+void testDeferred()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("DEFERRED logger");
+    builder->buildLoggerLevel(LogLevel::Level::DEBUG);
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildFormatter();
+    builder->buildDeferredFormat();
+    builder->buildOutputType<StdOutput>();
+    auto async_logger = builder->build();
+    string str = "测试延迟格式化";
+    async_logger->debug("%s-%d-%5.2f-%lld-%zu-%c-%x-%%", str.c_str(), -1, 3.14159, 1LL << 40, (size_t)10, 'c', 255);
+    async_logger->info("%-8s|%*d|%.*s|%p", "left", 6, 42, 3, "abcdef", (void *)&str);
+    async_logger->warning("%s", (const char *)nullptr);
+    // 带精度的字符串可以不以'\0'结尾
+    std::unique_ptr<char[]> raw(new char[4]);
+    memcpy(raw.get(), "rawX", 4);
+    async_logger->info("%.*s|%.3s|%.0s|%.*s", 4, raw.get(), raw.get(), raw.get(), -1, "负精度");
+    // %m依赖调用时的errno, 退回到在调用线程格式化
+    errno = ENOENT;
+    async_logger->error("%s: %m", "测试调用线程格式化");
+}
+
+enum TestColor
+{
+    RED = 1,
+    GREEN
+};
+void testTyped()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("TYPED logger");
+    builder->buildLoggerLevel(LogLevel::Level::DEBUG);
+    builder->buildFormatter();
+    builder->buildOutputType<StdOutput>();
+    auto lgr = builder->build();
+    string str = "测试类型安全接口";
+    LOG_DEBUG(lgr, "{}-{}-{}-{}-{}-{}", str, -1, 3.14159, 1ULL << 40, 'c', true);
+    LOG_INFO(lgr, "{{转义}}-{}-{}-{}", GREEN, (const char *)nullptr, (void *)&str);
+    LOG_WARNING(lgr, "没有参数");
+    // 超过栈上缓冲区的长消息
+    LOG_ERROR(lgr, "{}:{}", string(2000, 'a').size(), string(2000, 'b'));
+    // 超过编译器递归深度限制(默认512)的长格式串也能通过编译期检查
+    LOG_INFO(lgr,
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij "
+             "{{0123456789abcdefghijklmnopqrstuvwxyz}}:{}|0123456789abcdefghij",
+             1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+    // 格式串与参数个数不一致时编译失败
+    // LOG_FATAL(lgr, "{}-{}", 1);
+    // LOG_FATAL(lgr, "{", 1);
+    // 异步延迟格式化的日志器在调用线程格式化后以已格式化记录写入
+    builder->buildLoggerName("TYPED DEFERRED logger");
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildDeferredFormat();
+    auto async_lgr = builder->build();
+    LOG_FATAL(async_lgr, "{}-{}", str, 42);
+}
+
+// 每条日志调用在调用线程中的堆内存分配次数, 预热之后应当为0
+void testAlloc()
+{
+    auto count = [](const char *name, Logger::ptr lgr)
+    {
+        string str = "测试内存分配";
+        // 第一次调用会创建线程局部的缓冲区和缓存, 不计入统计
+        lgr->debug("%s-%d-%f", str.c_str(), 0, 1.5);
+        LOG_DEBUG(lgr, "{}-{}-{}", str, 0, 1.5);
+        size_t before = alloc_count;
+        for (int i = 0; i < 1000; ++i)
+        {
+            lgr->debug("%s-%d-%f", str.c_str(), i, 1.5);
+            LOG_DEBUG(lgr, "{}-{}-{}", str, i, 1.5);
+        }
+        size_t n = alloc_count - before;
+        cout << name << ": 2000条日志分配" << n << "次" << endl;
+    };
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("ALLOC sync");
+    builder->buildOutputType<FileOutput>("./logfile/alloc.log");
+    count("同步日志器", builder->build());
+    builder->buildLoggerName("ALLOC async");
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    count("异步日志器", builder->build());
+    builder->buildLoggerName("ALLOC staging");
+    builder->buildThreadStaging();
+    count("线程暂存区异步日志器", builder->build());
+    builder->buildLoggerName("ALLOC deferred");
+    builder->buildDeferredFormat();
+    count("延迟格式化异步日志器", builder->build());
+}
+
+// 等级不满足时日志宏不会对参数求值
+static int eval_count = 0;
+int evalArg()
+{
+    return ++eval_count;
+}
+void testLazyLevel()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("LAZY logger");
+    builder->buildLoggerLevel(LogLevel::Level::INFO);
+    builder->buildOutputType<StdOutput>();
+    auto lgr = builder->build();
+    lgr->debug("%d", evalArg());
+    LOG_DEBUG(lgr, "{}", evalArg());
+    cout << "等级不满足, 参数求值次数: " << eval_count << endl;
+    lgr->info("%d", evalArg());
+    LOG_INFO(lgr, "{}", evalArg());
+    cout << "等级满足, 参数求值次数: " << eval_count << endl;
+}
+
+// 模拟磁盘卡顿: 每次写入前等待一段时间
+class SlowOutput : public Output
+{
+public:
+    SlowOutput(const string &pathname, size_t ms)
+        : _file(pathname), _ms(ms) {}
+    void log(const char *data, size_t len)
+    {
+        this_thread::sleep_for(chrono::milliseconds(_ms));
+        _file.log(data, len);
+    }
+
+private:
+    FileOutput _file;
+    size_t _ms;
+};
+// 同一个线程的日志在暂存区超时收集和大记录之间依然按写入顺序输出
+void testStagingOrder()
+{
+    const char *names[] = {"mutex", "lockfree"};
+    for (int i = 0; i < 2; ++i)
+    {
+        string path = string("./logfile/staging_order_") + names[i] + ".log";
+        remove(path.c_str());
+        {
+            std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+            builder->buildLoggerName(string("STAGING order ") + names[i]);
+            builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+            builder->buildFormatter("%m%n");
+            builder->buildThreadStaging(4 * 1024, 5);
+            if (i == 1)
+                builder->buildLockFreeAsync(64 * 1024);
+            // 消费者处理每一批都很慢, 收集暂存区时之前发布的数据还在缓冲区中
+            builder->buildOutputType<SlowOutput>(path, 20);
+            auto lgr = builder->build();
+            string big(300 * 1024, 'x');
+            for (int j = 0; j < 200; ++j)
+            {
+                if (j % 40 == 0)
+                    lgr->info("%d-%s", j, big.c_str());
+                else
+                    lgr->info("%d", j);
+                // 大记录之后暂存的日志超时, 由消费者收集
+                this_thread::sleep_for(chrono::milliseconds(j % 40 == 1 ? 50 : 1));
+            }
+        }
+        ifstream ifs(path);
+        string line;
+        int last = -1, lines = 0;
+        bool ordered = true;
+        while (getline(ifs, line))
+        {
+            int n = atoi(line.c_str());
+            ordered = ordered && n == last + 1;
+            last = n;
+            ++lines;
+        }
+        cout << names[i] << ": 共" << lines << "条日志(应为200), 顺序" << (ordered ? "正确" : "错误") << endl;
+    }
+}
+void testBackpressure()
+{
+    const char *names[] = {"BLOCK_TIMEOUT", "DROP_NEWEST", "DROP_OLDEST", "DROP_LEVEL"};
+    AsyncType types[] = {ASYNC_BLOCK_TIMEOUT, ASYNC_DROP_NEWEST, ASYNC_DROP_OLDEST, ASYNC_DROP_LEVEL};
+    for (int i = 0; i < 4; ++i)
+    {
+        string path = string("./logfile/backpressure_") + names[i] + ".log";
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName(names[i]);
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildBackpressure(types[i], 5, LogLevel::Level::WARNING);
+        builder->buildOutputType<SlowOutput>(path, 200);
+        auto lgr = builder->build();
+        string msg(100, 'a');
+        double max_us = 0;
+        for (int j = 0; j < 30000; ++j)
+        {
+            auto start = chrono::steady_clock::now();
+            if (j % 4)
+                lgr->debug("%d-%s", j, msg.c_str());
+            else
+                lgr->warning("%d-%s", j, msg.c_str());
+            double us = chrono::duration_cast<chrono::duration<double, std::micro>>(chrono::steady_clock::now() - start).count();
+            max_us = std::max(max_us, us);
+        }
+        AsyncLogger *async_lgr = dynamic_cast<AsyncLogger *>(lgr.get());
+        cout << names[i] << ": 丢弃" << async_lgr->droppedMessages() << "条, " << async_lgr->droppedBytes()
+             << "字节, 最大写入耗时" << max_us << "us" << endl;
+    }
+}
+
+// 丢弃说明是WARNING等级, 只接收ERROR的输出不会收到
+void testDropNotice()
+{
+    string all = "./logfile/notice_all.log", alert = "./logfile/notice_alert.log";
+    remove(all.c_str());
+    remove(alert.c_str());
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("NOTICE logger");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("[%p]%m%n");
+        builder->buildBackpressure(ASYNC_DROP_NEWEST);
+        builder->buildOutputType<SlowOutput>(all, 50);
+        builder->buildOutputType<FileOutput>(alert);
+        builder->buildOutputLevel(LogLevel::Level::ERROR);
+        auto lgr = builder->build();
+        string msg(100, 'a');
+        for (int j = 0; j < 30000; ++j)
+            lgr->info("%d-%s", j, msg.c_str());
+        this_thread::sleep_for(chrono::milliseconds(100));
+        lgr->error("%s", "压力解除");
+    }
+    auto notices = [](const string &path)
+    {
+        ifstream ifs(path);
+        string line;
+        size_t n = 0;
+        while (getline(ifs, line))
+            n += line.find("dropped") != string::npos;
+        return n;
+    };
+    cout << "丢弃说明: 所有等级的输出" << notices(all) << "条(应大于0), ERROR输出" << notices(alert) << "条(应为0)" << endl;
+}
+
+// 超过异步缓冲区大小的日志不会阻塞生产者, 并且与前后的日志保持顺序
+void testLargeMessage()
+{
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("LARGE logger");
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildOutputType<FileOutput>("./logfile/large.log");
+    auto lgr = builder->build();
+    string dump(5 * 1024 * 1024, 'x');
+    for (int i = 0; i < 3; ++i)
+    {
+        lgr->info("before-%d", i);
+        lgr->info("%s", dump.c_str());
+        lgr->info("after-%d", i);
+    }
+    builder->buildLoggerName("LARGE DEFERRED logger");
+    builder->buildDeferredFormat();
+    auto deferred_lgr = builder->build();
+    deferred_lgr->info("deferred-%zu-%s", dump.size(), dump.c_str());
+    cout << "大日志写入完成" << endl;
+}
+
+// ASYNC_UNSAFE下消费者正在处理时写入大记录, 之后的写入追加在大记录之后, 不会阻塞, 顺序不变
+void testUnsafeSpill()
+{
+    std::atomic<bool> busy(false);
+    string out;
+    AsyncLooper looper([&](Buffer &buff, LogLevel::Level)
+                       {
+        busy = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto append = [&](const char *data, size_t len)
+        { out.append(data, len); };
+        buff.forEachSegment(append); },
+                       AsyncType::ASYNC_UNSAFE);
+    string large(400 * 1024, 'x');
+    auto start = std::chrono::steady_clock::now();
+    looper.push("first|", 6);
+    while (!busy)
+        std::this_thread::yield();
+    looper.push(large.data(), large.size());
+    looper.push("|second", 7);
+    looper.push(large.data(), large.size());
+    looper.push("|third", 6);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    looper.stop();
+    string expect = "first|" + large + "|second" + large + "|third";
+    cout << "写入耗时" << ms << "ms(应远小于100ms), 输出" << (out == expect ? "正确" : "错误") << endl;
+}
+
+// 分块缓冲区: 增长时不拷贝已有数据, 突发之后多余的块归还给块池
+void testChunkBuffer()
+{
+    Buffer buffer;
+    string line(1000, 'a');
+    size_t idle = ChunkPool::instance().idle();
+    for (int i = 0; i < 4096; ++i)
+    {
+        line[0] = 'a' + i % 26;
+        buffer.push(line.data(), line.size());
+    }
+    vector<struct iovec> iov;
+    buffer.segments(iov);
+    size_t total = 0;
+    bool ok = true;
+    for (auto &seg : iov)
+    {
+        // 每一段都由完整的写入组成
+        ok = ok && seg.iov_len % line.size() == 0;
+        total += seg.iov_len;
+    }
+    ok = ok && total == buffer.readableSize() && total == 4096 * line.size();
+    string data = buffer.getReadableData();
+    for (int i = 0; i < 4096; ++i)
+        ok = ok && data[i * line.size()] == 'a' + i % 26;
+    cout << "段数: " << iov.size() << ", 数据" << (ok ? "正确" : "错误") << endl;
+    buffer.reset();
+    cout << "重置后归还给块池的块数: " << ChunkPool::instance().idle() - idle << endl;
+    // 多个块的数据合并成连续内存
+    buffer.push(line.data(), line.size());
+    const char *p = buffer.begin();
+    cout << "合并后首字节: " << p[0] << endl;
+}
+
+// io_uring输出: 多个写入请求同时在途, 文件中的日志依然保持顺序
+void testUring()
+{
+    remove("./logfile/uring.log");
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("URING logger");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("%m%n");
+        builder->buildOutputType<UringOutput>("./logfile/uring.log", 4);
+        auto lgr = builder->build();
+        for (int i = 0; i < 200000; ++i)
+            lgr->info("%d", i);
+    }
+    ifstream ifs("./logfile/uring.log");
+    string line;
+    int expect = 0;
+    while (getline(ifs, line) && line == to_string(expect))
+        ++expect;
+    cout << "io_uring输出: " << (expect == 200000 ? "顺序正确" : "顺序错误") << ", 共" << expect << "条" << endl;
+}
+
+// 内存映射输出: 子进程写入后被SIGKILL杀死, 数据依然在文件中; 再次打开时去掉末尾预先扩展的全零区域
+void testMmap()
+{
+    remove("./logfile/mmap.log");
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("MMAP logger");
+        builder->buildFormatter("%m%n");
+        builder->buildOutputType<MmapOutput>("./logfile/mmap.log");
+        auto lgr = builder->build();
+        for (int i = 0; i < 100000; ++i)
+            lgr->info("%d", i);
+        raise(SIGKILL);
+    }
+    waitpid(pid, nullptr, 0);
+    struct stat st;
+    stat("./logfile/mmap.log", &st);
+    cout << "子进程被杀死后文件大小: " << st.st_size << endl;
+    {
+        // 重新打开后继续追加, 关闭时截断到实际大小
+        MmapOutput out("./logfile/mmap.log");
+        out.log("end\n", 4);
+    }
+    ifstream ifs("./logfile/mmap.log");
+    string line;
+    int expect = 0;
+    while (getline(ifs, line) && line == to_string(expect))
+        ++expect;
+    stat("./logfile/mmap.log", &st);
+    cout << "恢复" << expect << "条日志, 最后一行: " << line << ", 文件大小: " << st.st_size << endl;
+    // 滚动输出也可以使用内存映射文件
+    RollOutput roll("./logfile/mmap_roll/roll.log", 1024 * 1024, FileBackend::FILE_MMAP);
+    string data(1000, 'x');
+    data += '\n';
+    for (int i = 0; i < 5000; ++i)
+        roll.log(data.data(), data.size());
+}
+
+// 持久化策略: 同一批中的多条日志只需要一次fsync
+void testDurability()
+{
+    std::vector<Output::ptr> outs;
+    outs.push_back(OutputFactory::create<FdOutput>("./logfile/durable_level.log"));
+    outs.back()->setSyncPolicy(SyncPolicy::SYNC_LEVEL, LogLevel::Level::ERROR);
+    outs.push_back(OutputFactory::create<FileOutput>("./logfile/durable_bytes.log"));
+    outs.back()->setSyncPolicy(SyncPolicy::SYNC_BYTES, 1024 * 1024);
+    outs.push_back(OutputFactory::create<MmapOutput>("./logfile/durable_interval.log"));
+    outs.back()->setSyncPolicy(SyncPolicy::SYNC_INTERVAL, 50);
+    {
+        AsyncLogger lgr("DURABLE logger", LogLevel::Level::DEBUG, std::make_shared<Formatter>(), outs);
+        for (int i = 0; i < 100000; ++i)
+        {
+            if (i % 100 == 0)
+                lgr.error("%d-需要持久化的日志", i);
+            else
+                lgr.info("%d-普通日志", i);
+        }
+        sleep(1);
+    }
+    const char *names[] = {"SYNC_LEVEL", "SYNC_BYTES", "SYNC_INTERVAL"};
+    for (int i = 0; i < 3; ++i)
+    {
+        cout << names[i] << ": 同步" << outs[i]->syncCount() << "次, 平均" << outs[i]->syncAvgUs()
+             << "us, 最大" << outs[i]->syncMaxUs() << "us" << endl;
+    }
+}
+
+// flush返回后, 之前写入的日志都已经在文件中
+void testFlush()
+{
+    const char *names[] = {"MUTEX", "RING", "STAGING", "DEFERRED"};
+    for (int i = 0; i < 4; ++i)
+    {
+        string path = string("./logfile/flush_") + names[i] + ".log";
+        remove(path.c_str());
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName(string("FLUSH ") + names[i]);
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("%m%n");
+        builder->buildOutputType<FileOutput>(path);
+        if (i == 1)
+            builder->buildLockFreeAsync();
+        if (i == 2)
+            builder->buildThreadStaging();
+        if (i == 3)
+            builder->buildDeferredFormat();
+        auto lgr = builder->build();
+        size_t lines = 0;
+        bool ok = true;
+        for (int round = 1; round <= 3; ++round)
+        {
+            for (int j = 0; j < 10000; ++j)
+                lgr->info("%d-%d", round, j);
+            ok = lgr->flush(1000) && ok;
+            ifstream ifs(path);
+            string line;
+            lines = 0;
+            while (getline(ifs, line))
+                ++lines;
+            ok = ok && lines == (size_t)round * 10000;
+        }
+        cout << names[i] << ": flush后文件中有" << lines << "行, " << (ok ? "正确" : "错误") << endl;
+    }
+}
+
+// 崩溃处理: 子进程写完日志后立即崩溃, 还没有输出的日志和崩溃记录都应该出现在文件中
+void testCrash()
+{
+    const char *names[] = {"mutex", "lockfree", "staging"};
+    for (int i = 0; i < 3; ++i)
+    {
+        string path = string("./logfile/crash_") + names[i] + ".log";
+        remove(path.c_str());
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            CrashHandler::install();
+            std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+            builder->buildLoggerName(string("CRASH ") + names[i]);
+            builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+            builder->buildFormatter("%m%n");
+            builder->buildOutputType<FdOutput>(path);
+            if (i == 1)
+                builder->buildLockFreeAsync();
+            if (i == 2)
+                builder->buildThreadStaging();
+            auto lgr = builder->build();
+            for (int j = 0; j < 10000; ++j)
+                lgr->info("%d", j);
+            if (i == 0)
+                abort();
+            *(volatile int *)nullptr = 0;
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        // 日志可能重复, 但每一条都要出现
+        std::vector<bool> seen(10000, false);
+        size_t found = 0;
+        bool record = false;
+        ifstream ifs(path);
+        string line;
+        while (getline(ifs, line))
+        {
+            if (line.find("caught signal") != string::npos)
+                record = true;
+            else if (!line.empty() && isdigit(line[0]))
+            {
+                int n = atoi(line.c_str());
+                if (n >= 0 && n < 10000 && !seen[n])
+                {
+                    seen[n] = true;
+                    ++found;
+                }
+            }
+        }
+        cout << names[i] << ": 终止信号" << (WIFSIGNALED(status) ? WTERMSIG(status) : 0)
+             << ", 找到" << found << "条日志, 崩溃记录" << (record ? "存在" : "缺失") << endl;
+    }
+}
+
+// 共享执行器: 多个异步日志器由两个工作线程处理, 每个日志器内部的顺序不变
+void testExecutor()
+{
+    auto executor = std::make_shared<AsyncExecutor>(2, std::vector<int>{0});
+    std::vector<Logger::ptr> loggers;
+    for (int i = 0; i < 12; ++i)
+    {
+        string path = "./logfile/executor_" + to_string(i) + ".log";
+        remove(path.c_str());
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("EXECUTOR " + to_string(i));
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("%m%n");
+        builder->buildOutputType<FileOutput>(path);
+        builder->buildExecutor(executor);
+        if (i % 3 == 1)
+            builder->buildLockFreeAsync();
+        if (i % 3 == 2)
+            builder->buildThreadStaging();
+        loggers.push_back(builder->build());
+    }
+    std::vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]()
+                             {
+            for (int j = 0; j < 20000; ++j)
+                loggers[(j + t) % loggers.size()]->info("%d-%d", t, j); });
+    }
+    for (auto &th : threads)
+        th.join();
+    for (auto &lgr : loggers)
+        lgr->flush();
+    // 每个文件中同一个线程的日志必须按写入顺序出现
+    size_t total = 0;
+    bool ordered = true;
+    for (size_t i = 0; i < loggers.size(); ++i)
+    {
+        ifstream ifs("./logfile/executor_" + to_string(i) + ".log");
+        string line;
+        int last[4] = {-1, -1, -1, -1};
+        while (getline(ifs, line))
+        {
+            int t = 0, j = 0;
+            sscanf(line.c_str(), "%d-%d", &t, &j);
+            ordered = ordered && j > last[t];
+            last[t] = j;
+            ++total;
+        }
+    }
+    loggers.clear();
+    cout << "执行器线程数: " << executor->threads() << ", 共" << total << "条日志(应为80000), 顺序"
+         << (ordered ? "正确" : "错误") << endl;
+}
+
+// 只有一个工作线程的执行器和独立队列一起使用时, 刷新和析构都不会互相等待
+void testExecutorQueue()
+{
+    string path = "./logfile/executor_queue.log";
+    remove(path.c_str());
+    auto executor = std::make_shared<AsyncExecutor>(1);
+    auto begin = chrono::steady_clock::now();
+    bool flushed;
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("EXECUTOR queue");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("%m%n");
+        builder->buildExecutor(executor);
+        builder->buildOutputType<FileOutput>(path);
+        builder->buildOutputQueue();
+        auto lgr = builder->build();
+        lgr->info("%d", 1);
+        flushed = lgr->flush(2000);
+        lgr->info("%d", 2);
+    }
+    auto cost = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    ifstream ifs(path);
+    string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    cout << "刷新" << (flushed ? "成功" : "超时") << ", 析构后文件内容" << (content == "1\n2\n" ? "正确" : "错误")
+         << ", 耗时" << cost << "ms" << endl;
+}
+
+// 输出独立队列: 慢输出使用自己的队列并丢弃新数据, 快输出和生产者不受影响
+void testOutputQueue()
+{
+    remove("./logfile/queue_fast.log");
+    remove("./logfile/queue_slow.log");
+    remove("./logfile/queue_block.log");
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("QUEUE logger");
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildFormatter("%m%n");
+    builder->buildOutputType<FileOutput>("./logfile/queue_fast.log");
+    builder->buildOutputType<SlowOutput>("./logfile/queue_slow.log", 20);
+    builder->buildOutputQueue(64 * 1024, AsyncType::ASYNC_DROP_NEWEST);
+    builder->buildOutputType<FdOutput>("./logfile/queue_block.log");
+    builder->buildOutputQueue();
+    auto lgr = builder->build();
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < 200000; ++i)
+    {
+        lgr->info("%d", i);
+        if (i % 1000 == 0)
+            this_thread::sleep_for(chrono::microseconds(500));
+    }
+    // 快输出在慢输出写完之前就已经完整
+    this_thread::sleep_for(chrono::milliseconds(200));
+    auto count = [](const char *path)
+    {
+        ifstream ifs(path);
+        string line;
+        size_t n = 0;
+        while (getline(ifs, line))
+            ++n;
+        return n;
+    };
+    size_t fast = count("./logfile/queue_fast.log");
+    auto cost = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    lgr->flush();
+    cout << "耗时" << cost << "ms, 快输出" << fast << "行, 独立队列输出" << count("./logfile/queue_block.log")
+         << "行, 慢输出" << count("./logfile/queue_slow.log") << "行(包含丢弃说明)" << endl;
+}
+
+// 每个输出有自己的等级和格式, 相同模式的输出共享格式化结果
+void testOutputRoute()
+{
+    const char *names[] = {"sync", "async"};
+    for (int i = 0; i < 2; ++i)
+    {
+        string base = string("./logfile/route_") + names[i];
+        const char *files[] = {"_all.log", "_alert.log", "_json.log", "_json_warn.log"};
+        for (auto f : files)
+            remove((base + f).c_str());
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName(string("ROUTE ") + names[i]);
+        if (i == 1)
+            builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("[%p]%m%n");
+        builder->buildOutputType<FileOutput>(base + "_all.log");
+        builder->buildOutputType<FileOutput>(base + "_alert.log");
+        builder->buildOutputLevel(LogLevel::Level::ERROR);
+        builder->buildOutputType<FileOutput>(base + "_json.log");
+        builder->buildOutputLevel(LogLevel::Level::INFO);
+        builder->buildOutputFormatter("{\"level\":\"%p\",\"msg\":\"%m\"}%n");
+        builder->buildOutputType<FileOutput>(base + "_json_warn.log");
+        builder->buildOutputLevel(LogLevel::Level::WARNING);
+        builder->buildOutputFormatter("{\"level\":\"%p\",\"msg\":\"%m\"}%n");
+        auto lgr = builder->build();
+        for (int j = 0; j < 1000; ++j)
+        {
+            lgr->debug("%d", j);
+            lgr->info("%d", j);
+            lgr->warning("%d", j);
+            lgr->error("%d", j);
+        }
+        lgr->flush();
+        cout << names[i] << ":";
+        for (auto f : files)
+        {
+            ifstream ifs(base + f);
+            string line, last;
+            size_t n = 0;
+            while (getline(ifs, line))
+            {
+                ++n;
+                last = line;
+            }
+            cout << " " << f << "=" << n << "(" << last << ")";
+        }
+        cout << " (应为4000, 1000, 3000, 2000)" << endl;
+    }
+    // 所有输出都不需要的日志在格式化之前就丢弃
+    std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("ROUTE drop");
+    builder->buildOutputType<FileOutput>("./logfile/route_drop.log");
+    builder->buildOutputLevel(LogLevel::Level::ERROR);
+    auto lgr = builder->build();
+    cout << "输出最低等级为ERROR时, WARNING是否启用: " << lgr->enabled(LogLevel::Level::WARNING) << endl;
+}
+
+// 滚动后的旧文件在后台压缩, 解压后的内容与写入的日志一致
+void testCompress()
+{
+    string dir = "./logfile/compress/";
+    system(("rm -rf " + dir).c_str());
+    Compressor::ptr compressor = std::make_shared<Compressor>();
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("COMPRESS");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildOutputType<RollOutput>(dir + "roll-", 256 * 1024);
+        builder->buildCompression(CompressCodec::CODEC_LZ, compressor);
+        auto lgr = builder->build();
+        for (int i = 0; i < 100000; ++i)
+            lgr->info("第%d条日志, 滚动之后在后台压缩", i);
+    }
+    compressor->wait();
+    // 解压所有压缩文件, 加上最后一个没有滚动的文件, 统计日志条数
+    size_t compressed = 0, plain = 0, lines = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr)
+    {
+        string name = ent->d_name;
+        if (name[0] == '.')
+            continue;
+        ifstream ifs(dir + name, std::ios::binary);
+        string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".lz") == 0)
+        {
+            string raw;
+            if (!LzCodec::decompress(data, raw))
+                cout << "解压失败: " << name << endl;
+            data.swap(raw);
+            ++compressed;
+        }
+        else
+            ++plain;
+        lines += std::count(data.begin(), data.end(), '\n');
+    }
+    closedir(d);
+    CompressStats st = compressor->stats();
+    cout << "压缩文件" << compressed << "个, 未压缩文件" << plain << "个, 共" << lines << "条日志(应为100000)" << endl;
+    cout << "压缩前" << st._raw_bytes << "字节, 压缩后" << st._out_bytes << "字节, 压缩率" << st.ratio()
+         << ", CPU时间" << st._cpu_us << "us, 失败" << st._failed << "个" << endl;
+}
+
+// 保留策略: 启动时扫描到的过期文件被删除, 之后只保留最新的若干个文件
+void testRetention()
+{
+    string dir = "./logfile/retention/";
+    system(("rm -rf " + dir).c_str());
+    Util::File::create_directory(dir);
+    // 上次运行留下的文件, 修改时间在两天前
+    for (int i = 0; i < 3; ++i)
+    {
+        string name = dir + "roll-old" + std::to_string(i) + ".log";
+        ofstream(name) << "old" << endl;
+        struct timeval tv[2] = {{time(nullptr) - 2 * 24 * 3600, 0}, {time(nullptr) - 2 * 24 * 3600, 0}};
+        utimes(name.c_str(), tv);
+    }
+    Compressor::ptr compressor = std::make_shared<Compressor>();
+    Janitor::ptr janitor = std::make_shared<Janitor>();
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("RETENTION");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildOutputType<RollOutput>(dir + "roll-", 64 * 1024);
+        builder->buildCompression(CompressCodec::CODEC_LZ, compressor);
+        builder->buildRetention(5, 0, 24 * 3600, janitor);
+        auto lgr = builder->build();
+        for (int i = 0; i < 100000; ++i)
+            lgr->info("第%d条日志, 只保留最新的5个旧文件", i);
+    }
+    compressor->wait();
+    janitor->wait();
+    size_t files = 0, old = 0, compressed = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr)
+    {
+        string name = ent->d_name;
+        if (name[0] == '.')
+            continue;
+        ++files;
+        if (name.find("old") != string::npos)
+            ++old;
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".lz") == 0)
+            ++compressed;
+    }
+    closedir(d);
+    cout << "剩余文件" << files << "个(应为6), 其中压缩文件" << compressed << "个(应为5), 过期文件" << old << "个(应为0)" << endl;
+    cout << "共删除" << janitor->deletedFiles() << "个文件, " << janitor->deletedBytes() << "字节" << endl;
+
+    // 登记时已经打开的文件即使看起来已经过期, 也不会被扫描删除
+    string active_dir = dir + "active/";
+    Util::File::create_directory(active_dir);
+    TimeRollOutput active(active_dir + "day-", TimeGap::Day);
+    d = opendir(active_dir.c_str());
+    string active_name;
+    while ((ent = readdir(d)) != nullptr)
+    {
+        if (ent->d_name[0] != '.')
+            active_name = active_dir + ent->d_name;
+    }
+    closedir(d);
+    struct timeval tv[2] = {{time(nullptr) - 2 * 24 * 3600, 0}, {time(nullptr) - 2 * 24 * 3600, 0}};
+    utimes(active_name.c_str(), tv);
+    active.setRetention(RetentionPolicy(0, 0, 3600), janitor);
+    janitor->wait();
+    cout << "正在写入的文件" << (access(active_name.c_str(), F_OK) == 0 ? "保留" : "被删除(错误)") << endl;
+}
+
+// 提前打开下一个文件并在后台关闭旧文件, 所有日志都写入文件, 不会留下提前打开但没有用到的空文件
+void testPreopen()
+{
+    string dir = "./logfile/preopen/";
+    system(("rm -rf " + dir).c_str());
+    {
+        std::shared_ptr<LoggerBuilder> builder(new LocalLoggerBuilder());
+        builder->buildLoggerName("PREOPEN");
+        builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+        builder->buildFormatter("%m%n");
+        builder->buildOutputType<RollOutput>(dir + "roll-", 64 * 1024, FileBackend::FILE_FD);
+        builder->buildPreopen(true);
+        builder->buildOutputType<TimeRollOutput>(dir + "time-", TimeGap::Sec);
+        builder->buildPreopen();
+        auto lgr = builder->build();
+        // 持续2.5秒, 按时间滚动的输出至少切换两次
+        for (int i = 0; i < 250; ++i)
+        {
+            for (int j = 0; j < 400; ++j)
+                lgr->info("%d", i * 400 + j);
+            usleep(10 * 1000);
+        }
+    }
+    size_t roll_files = 0, time_files = 0, empty = 0, roll_lines = 0, time_lines = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr)
+    {
+        string name = ent->d_name;
+        if (name[0] == '.')
+            continue;
+        ifstream ifs(dir + name);
+        string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        size_t n = std::count(data.begin(), data.end(), '\n');
+        if (data.empty())
+            ++empty;
+        if (name.compare(0, 5, "roll-") == 0)
+        {
+            ++roll_files;
+            roll_lines += n;
+        }
+        else
+        {
+            ++time_files;
+            time_lines += n;
+        }
+    }
+    closedir(d);
+    cout << "按大小滚动: " << roll_files << "个文件, " << roll_lines << "条日志(应为100000)" << endl;
+    cout << "按时间滚动: " << time_files << "个文件, " << time_lines << "条日志(应为100000)" << endl;
+    cout << "空文件" << empty << "个(应为0)" << endl;
+}
+
 void testMacro()
 {
     //DEBUG("%s", "测试");
@@ -321,6 +1362,8 @@ int main()
 {
     // testLevel();
     // testFormat();
+    // testTimeCache();
+    // testClock();
     // testOut2();
     // testSync();
     // testBulider();
@@ -335,6 +1378,31 @@ int main()
     //     ;
     // }
     //testAsync2();
+    //testLockFree();
+    //testStaging();
+    //testStagingOrder();
+    //testRuntimeFormat();
+    //testDeferred();
+    //testTyped();
+    //testAlloc();
+    //testLazyLevel();
+    //testBackpressure();
+    //testDropNotice();
+    //testLargeMessage();
+    //testUnsafeSpill();
+    //testChunkBuffer();
+    //testUring();
+    //testMmap();
+    //testDurability();
+    //testFlush();
+    //testCrash();
+    //testExecutor();
+    //testExecutorQueue();
+    //testOutputQueue();
+    //testOutputRoute();
+    //testCompress();
+    //testRetention();
+    //testPreopen();
     testMacro();
     //sleep(2);
     //LoggerManager::getLoggerManager()->~LoggerManager();
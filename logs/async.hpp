@@ -1,31 +1,86 @@
 #pragma once
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include "buffer.hpp"
+#include "level.hpp"
+#include "ring.hpp"
+#include "executor.hpp"
 
 namespace Log
 {
-    // 该类实现两个缓冲区的交换, 当消费缓冲区为空时,
+// 阻塞等待策略的默认超时时间(毫秒)
+#define ASYNC_DEFAULT_TIMEOUT 10
+    // 缓冲区满时生产者的处理策略
     enum AsyncType
     {
-        ASYNC_SAFE,
-        ASYNC_UNSAFE,
+        ASYNC_SAFE,          // 阻塞等待, 直到消费者腾出空间
+        ASYNC_UNSAFE,        // 缓冲区无限扩容
+        ASYNC_BLOCK_TIMEOUT, // 阻塞等待, 超时后丢弃这条日志
+        ASYNC_DROP_NEWEST,   // 丢弃新写入的日志
+        ASYNC_DROP_OLDEST,   // 丢弃生产缓冲区中所有尚未交给消费者的日志, 腾出空间写入新日志
+        ASYNC_DROP_LEVEL,    // 丢弃低于指定等级的日志, 其余日志阻塞等待
     };
-    using functor = std::function<void(Buffer &)>;
-    class AsyncLooper
+    // 生产者与消费者之间的队列实现
+    enum LooperType
+    {
+        LOOPER_MUTEX, // 互斥锁保护的双缓冲区
+        LOOPER_RING,  // 无锁多生产者单消费者环形缓冲区
+    };
+    // 消费者回调, 参数为一批数据以及其中日志的最高等级
+    using functor = std::function<void(Buffer &, LogLevel::Level)>;
+    // 刷新请求的回调, 在消费者处理完请求之前的所有数据之后调用
+    using flusher = std::function<void()>;
+    // 异步循环默认拥有一个消费者线程, 指定共享执行器时不创建线程, 由执行器的工作线程处理
+    class AsyncLooper : public ExecutorTask
     {
     public:
         using ptr = std::shared_ptr<AsyncLooper>;
-        AsyncLooper(const functor &cb, AsyncType async_type = AsyncType::ASYNC_SAFE)
+        AsyncLooper(const functor &cb,
+                    AsyncType async_type = AsyncType::ASYNC_SAFE,
+                    LooperType looper_type = LooperType::LOOPER_MUTEX,
+                    size_t ring_size = RING_DEFAULT_SIZE,
+                    const flusher &flush_cb = flusher(),
+                    const AsyncExecutor::ptr &executor = AsyncExecutor::ptr())
             : _stop(false),
-              _thread(std::thread(&AsyncLooper::threadEntry, this)),
+              _exited(false),
+              _flush_req(0),
+              _flush_done(0),
+              _flush_tail(0),
+              _large_size(BUFFER_DEFAULT_SIZE / 4),
+              _parked(false),
+              _tick(false),
+              _interval_ms(0),
+              _pending_msgs(0),
+              _pending_level(LogLevel::Level::UNKNOW),
+              _spill_level(LogLevel::Level::UNKNOW),
+              _dropped_msgs(0),
+              _dropped_bytes(0),
+              _report_msgs(0),
+              _report_bytes(0),
+              _timeout_ms(ASYNC_DEFAULT_TIMEOUT),
+              _drop_level(LogLevel::Level::WARNING),
+              _async_type(async_type),
+              _looper_type(looper_type),
               _callback(cb),
-              _async_type(async_type)
+              _flush_cb(flush_cb),
+              _executor(executor)
         {
             //std::cout << "AsyncLooper construction"<< std::endl;
+            if (_looper_type == LooperType::LOOPER_RING)
+                _ring.reset(new RingBuffer(ring_size));
+            if (_executor)
+            {
+                // 初始为空闲状态, 第一次写入时才加入执行器的就绪队列
+                _parked = true;
+                _executor->add(this);
+                return;
+            }
+            // 所有成员初始化完成后再启动线程, 防止线程访问到未初始化的回调函数
+            _thread = std::thread(&AsyncLooper::threadEntry, this);
         }
         ~AsyncLooper()
         {
@@ -34,72 +89,492 @@ namespace Log
         }
         void stop()
         {
-            _stop = true;                // 将标记为置为true, 表示退出
-            _cond_consumer.notify_all(); // 通知所有的消费者, 让消费者线程退出
-            _thread.join();
+            if (_stop.exchange(true)) // 将标记为置为true, 表示退出, 重复调用直接返回
+                return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            wake(); // 通知消费者处理完剩余的数据后退出
+            if (!_executor)
+            {
+                lock.unlock();
+                _thread.join();
+                return;
+            }
+            // 等待执行器处理完剩余的数据, 注销之后执行器不会再访问这里
+            _cond_flush.wait(lock, [&]
+                             { return _exited; });
+            lock.unlock();
+            _executor->remove(this);
+        }
+        // 等待消费者处理完调用之前写入的所有数据, 并执行刷新回调, timeout_ms为0时一直等待, 超时返回false
+        // 每次请求分配一个递增的序号, 消费者在交换缓冲区时读取最新的序号, 处理完这一批后将其标记为完成
+        // 因此生产者的写入路径上不需要任何额外的计数
+        bool flush(size_t timeout_ms = 0)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // 无锁模式下已经预留但还未提交的记录也属于请求之前的数据, 记录此时的预留位置
+            if (_ring)
+                _flush_tail.store(_ring->tail(), std::memory_order_relaxed);
+            size_t id = ++_flush_req;
+            wake();
+            auto done = [&]
+            { return _flush_done >= id || _exited; };
+            if (timeout_ms == 0)
+            {
+                _cond_flush.wait(lock, done);
+                return true;
+            }
+            return _cond_flush.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+        }
+        // 设置消费者的定时唤醒间隔(毫秒), 超时后即使没有数据也会执行一次回调, 0表示只在有数据时唤醒
+        void setWakeupInterval(size_t ms)
+        {
+            _interval_ms = ms;
+            if (_executor)
+                return _executor->retime();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond_consumer.notify_all();
+        }
+
+        // 由共享执行器调用: 处理一批数据, 没有数据时进入空闲状态, 之后由生产者或定时器重新调度
+        bool runOnce()
+        {
+            int ret = consume(_tick.exchange(false));
+            if (ret < 0)
+            {
+                // 退出之后不再访问任何成员, 等待退出的线程随时可能析构这里
+                finishAll();
+                return false;
+            }
+            if (ret > 0)
+                return true;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _parked.store(true, std::memory_order_relaxed);
+            // 与生产者中的屏障配对, 进入空闲状态前再检查一次, 保证不会丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!hasWork())
+                return false;
+            _parked.store(false, std::memory_order_relaxed);
+            return true;
+        }
+        size_t tickInterval()
+        {
+            return _interval_ms;
+        }
+        void tick()
+        {
+            _tick.store(true, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(_mutex);
+            wake();
+        }
+
+        // 设置ASYNC_BLOCK_TIMEOUT的超时时间和ASYNC_DROP_LEVEL丢弃的等级(低于该等级的日志会被丢弃)
+        void setBackpressure(size_t timeout_ms, LogLevel::Level drop_level)
+        {
+            _timeout_ms = timeout_ms;
+            _drop_level = drop_level;
+        }
+        // 累计丢弃的日志条数和字节数
+        size_t droppedMessages()
+        {
+            return _dropped_msgs.load(std::memory_order_relaxed);
+        }
+        size_t droppedBytes()
+        {
+            return _dropped_bytes.load(std::memory_order_relaxed);
+        }
+        // 取出上次报告之后丢弃的条数和字节数, 没有丢弃时返回false, 由消费者在压力解除后报告
+        bool takeDropped(size_t &msgs, size_t &bytes)
+        {
+            if (_report_msgs.load(std::memory_order_relaxed) == 0)
+                return false;
+            std::unique_lock<std::mutex> lock(_mutex);
+            msgs = _report_msgs.exchange(0, std::memory_order_relaxed);
+            bytes = _report_bytes.exchange(0, std::memory_order_relaxed);
+            return msgs != 0;
+        }
+        // 进程崩溃时由信号处理函数调用, 不加锁地对还没有输出的数据依次调用f(data, len)
+        // 消费缓冲区可能已经输出了一部分, 其中的日志可能重复, 但不会丢失
+        template <typename F>
+        void drainUnsafe(F &f)
+        {
+            _buff_consumer.forEachSegment(f);
+            _buff_producer.forEachSegment(f);
+            if (_spill)
+                _spill->forEachSegment(f);
+            if (_ring)
+                _ring->forEachCommitted(f);
         }
 
-        void push(const char *data, size_t len)
+        // 写入count条日志, level为其中的最高等级, 根据策略被丢弃时返回false
+        bool push(const char *data, size_t len, LogLevel::Level level = LogLevel::Level::FATAL, size_t count = 1)
         {
+            if (_looper_type == LooperType::LOOPER_RING)
+                return pushRing(data, len, level, count);
             // std::cout << "push :: data = " << data << std::endl;
             // std::cout << "push :: len = " << len << std::endl;
 
+            // 大记录在加锁前拷贝到单独的缓冲区中, 挂在生产缓冲区之后一起交给消费者
+            // 这样超过缓冲区大小的记录也不会永久阻塞, 两个缓冲区也不需要为它扩容
+            std::unique_ptr<Buffer> large;
+            if (len > _large_size)
+            {
+                large.reset(new Buffer(len));
+                large->push(data, len);
+            }
             // 设置临界资源的访问
             std::unique_lock<std::mutex> lock(_mutex);
             // 判断缓冲区是否满足条件(不扩容模式下才需要判断)
-            if (_async_type == AsyncType::ASYNC_SAFE)
-                _cond_producer.wait(lock, [&]
-                                    { return _buff_producer.writeableSize() >= len; });
+            if (!reserve(lock, large ? 0 : len, level))
+            {
+                drop(count, len);
+                return false;
+            }
             // 向生产缓冲区压入数据
-            _buff_producer.push(data, len);
+            if (_spill)
+            {
+                // 只有ASYNC_UNSAFE会在已经挂了大记录时继续写入, 追加在大记录之后保证输出顺序
+                _spill->push(data, len);
+                _spill_level = std::max(_spill_level, level);
+            }
+            else if (large)
+            {
+                _spill = std::move(large);
+                _spill_level = level;
+            }
+            else
+            {
+                _buff_producer.push(data, len);
+                _pending_level = std::max(_pending_level, level);
+            }
+            _pending_msgs += count;
             // 唤醒消费者线程对缓冲区数据进行处理
-            _cond_consumer.notify_one();
+            wake();
+            return true;
+        }
+
+        // 由消费者线程在回调中写入, 不等待也不受策略限制, 数据排在之前写入的所有数据之后, 在下一批中处理
+        // 无锁模式下环形缓冲区已满时返回false
+        bool pushFromConsumer(const char *data, size_t len, LogLevel::Level level, size_t count = 1)
+        {
+            if (_looper_type == LooperType::LOOPER_RING)
+                return _ring->tryPush(data, len, (uint8_t)level);
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_spill)
+            {
+                _spill->push(data, len);
+                _spill_level = std::max(_spill_level, level);
+            }
+            else
+            {
+                _buff_producer.push(data, len);
+                _pending_level = std::max(_pending_level, level);
+            }
+            _pending_msgs += count;
+            return true;
         }
 
     private:
-        void threadEntry()
+        // 按照策略等待生产缓冲区有足够的空间, 返回false表示这次写入需要丢弃
+        // 生产缓冲区之后已经挂了大记录时, 后续的记录需要等待交换, 保证输出顺序; ASYNC_UNSAFE直接追加在大记录之后
+        bool reserve(std::unique_lock<std::mutex> &lock, size_t len, LogLevel::Level level)
         {
-            while (1)
+            auto writeable = [&]
+            { return !_spill && _buff_producer.writeableSize() >= len; };
+            switch (_async_type)
+            {
+            case AsyncType::ASYNC_UNSAFE:
+                return true;
+            case AsyncType::ASYNC_BLOCK_TIMEOUT:
+                return _cond_producer.wait_for(lock, std::chrono::milliseconds(_timeout_ms), writeable);
+            case AsyncType::ASYNC_DROP_NEWEST:
+                return writeable();
+            case AsyncType::ASYNC_DROP_OLDEST:
+                if (writeable())
+                    return true;
+                // 丢弃还没有交给消费者的日志, 单条日志超过缓冲区大小时依然只能丢弃它自己
+                drop(_pending_msgs, _buff_producer.readableSize() + (_spill ? _spill->readableSize() : 0));
+                _buff_producer.reset();
+                _spill.reset();
+                _pending_msgs = 0;
+                _pending_level = LogLevel::Level::UNKNOW;
+                return writeable();
+            case AsyncType::ASYNC_DROP_LEVEL:
+                if (level < _drop_level)
+                    return writeable();
+                break;
+            default:
+                break;
+            }
+            _cond_producer.wait(lock, writeable);
+            return true;
+        }
+        void drop(size_t msgs, size_t bytes)
+        {
+            _dropped_msgs.fetch_add(msgs, std::memory_order_relaxed);
+            _dropped_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            _report_msgs.fetch_add(msgs, std::memory_order_relaxed);
+            _report_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        // 无锁模式下的写入: 快速路径只操作原子变量, 只有消费者休眠时才加锁唤醒
+        // 生产者无法丢弃环中已有的记录, ASYNC_DROP_OLDEST按照ASYNC_DROP_NEWEST处理
+        bool pushRing(const char *data, size_t len, LogLevel::Level level, size_t count)
+        {
+            // 日志等级保存在记录头部, 消费者据此得到每一批的最高等级
+            uint8_t tag = (uint8_t)level;
+            if (!_ring->tryPush(data, len, tag))
             {
-                // 设置一段临界区, 只对缓冲区的交换进行上锁, 不对数据处理上锁
+                bool dropped = false;
+                switch (_async_type)
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    // 当退出状态为真且生产缓冲区为空时退出
-                    if (_stop && _buff_producer.empty())
+                case AsyncType::ASYNC_BLOCK_TIMEOUT:
+                {
+                    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_timeout_ms);
+                    while (!(_ring->tryPush(data, len, tag)))
                     {
-                        //std::cout << _buff_consumer.getReadableData();
-                        //std::cout << _buff_producer.getReadableData();
-                        //std::cout << "async looper exit" << std::endl;
+                        if (std::chrono::steady_clock::now() >= deadline)
+                        {
+                            dropped = true;
+                            break;
+                        }
+                        std::this_thread::yield();
+                    }
+                    break;
+                }
+                case AsyncType::ASYNC_DROP_NEWEST:
+                case AsyncType::ASYNC_DROP_OLDEST:
+                    dropped = true;
+                    break;
+                case AsyncType::ASYNC_DROP_LEVEL:
+                    if (level < _drop_level)
+                    {
+                        dropped = true;
                         break;
                     }
+                    // fallthrough
+                default:
+                    // 环形缓冲区已满时让出CPU等待消费者处理
+                    while (!_ring->tryPush(data, len, tag))
+                        std::this_thread::yield();
+                    break;
+                }
+                if (dropped)
+                {
+                    drop(count, len);
+                    return false;
+                }
+            }
+            // 提交记录与读取休眠标记之间需要全序, 与消费者中的屏障配对, 保证不会丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_parked.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                wake();
+            }
+            return true;
+        }
+
+        void threadEntryRing()
+        {
+            bool tick = false;
+            while (1)
+            {
+                int ret = consumeRing(tick);
+                if (ret < 0)
+                    break;
+                tick = false;
+                if (ret > 0)
+                    continue;
+                std::unique_lock<std::mutex> lock(_mutex);
+                _parked.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // 定时唤醒时依然执行一次回调, 由回调决定是否有需要处理的数据
+                tick = !waitConsumer(lock, [&]
+                                     { return _stop || _ring->readable() || flushPending(); });
+                _parked.store(false, std::memory_order_relaxed);
+            }
+            finishAll();
+        }
+        // 处理一批数据, 返回-1表示已经处理完所有数据可以退出, 0表示没有数据, 1表示处理了一批
+        // tick为真表示定时唤醒, 即使没有数据也执行一次回调
+        int consume(bool tick)
+        {
+            if (_looper_type == LooperType::LOOPER_RING)
+                return consumeRing(tick);
+            return consumeMutex(tick);
+        }
+        int consumeRing(bool tick)
+        {
+            // 先读取刷新序号再取数据, 读到的预留位置不会早于这个序号对应的位置
+            size_t flush_req = _flush_req.load(std::memory_order_acquire);
+            uint64_t flush_tail = _flush_tail.load(std::memory_order_relaxed);
+            uint8_t level = LogLevel::Level::UNKNOW;
+            size_t len = _ring->popTo(_buff_consumer, &level);
+            // 请求之前预留的记录还没有全部提交时, 这一批处理完后不能完成刷新
+            if (flush_req != _flush_done && _ring->head() < flush_tail)
+                flush_req = _flush_done;
+            if (len == 0 && flush_req == _flush_done)
+            {
+                // 退出时需要等待所有已预留的记录提交完成
+                if (_stop && _ring->empty())
+                    return -1;
+                if (flushPending())
+                    std::this_thread::yield(); // 等待生产者完成提交
+                if (!tick)
+                    return 0;
+            }
+            // 回调接口与互斥模式一致, 依然以缓冲区的形式交给消费者处理
+            _callback(_buff_consumer, (LogLevel::Level)level);
+            _buff_consumer.reset();
+            finishFlush(flush_req);
+            return 1;
+        }
+        int consumeMutex(bool tick)
+        {
+            std::unique_ptr<Buffer> spill;
+            LogLevel::Level level, spill_level;
+            size_t flush_req;
+            // 设置一段临界区, 只对缓冲区的交换进行上锁, 不对数据处理上锁
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                bool ready = !_buff_producer.empty() || _spill || flushPending();
+                // 当退出状态为真且生产缓冲区为空时退出
+                if (_stop && !ready)
+                    return -1;
+                if (!ready && !tick)
+                    return 0;
+                // 生产缓冲区有数据, 交换两个缓冲区
+                _buff_producer.swap(_buff_consumer);
+                spill = std::move(_spill);
+                flush_req = _flush_req.load(std::memory_order_relaxed);
+                level = _pending_level;
+                spill_level = _spill_level;
+                _pending_msgs = 0;
+                _pending_level = LogLevel::Level::UNKNOW;
+            }
+            // 唤醒生产者
+            _cond_producer.notify_all();
+            // 处理消费缓冲区中的数据
+            _callback(_buff_consumer, level);
+            //  重制缓冲区
+            _buff_consumer.reset();
+            // 再处理挂在之后的大记录, 处理完立即释放
+            if (spill)
+                _callback(*spill, spill_level);
+            finishFlush(flush_req);
+            return 1;
+        }
+        // 是否有需要消费者处理的数据或请求, 调用时持有_mutex
+        bool hasWork()
+        {
+            if (_stop || flushPending() || _tick.load(std::memory_order_relaxed))
+                return true;
+            if (_ring)
+                return _ring->readable();
+            return !_buff_producer.empty() || _spill;
+        }
+        // 通知消费者, 调用时持有_mutex
+        // 使用共享执行器时, 只有空闲状态的异步循环才加入就绪队列, 因此在队列中最多出现一次
+        void wake()
+        {
+            if (!_executor)
+                return _cond_consumer.notify_one();
+            if (_parked.load(std::memory_order_relaxed))
+            {
+                _parked.store(false, std::memory_order_relaxed);
+                _executor->schedule(this);
+            }
+        }
+
+        bool flushPending()
+        {
+            return _flush_req.load(std::memory_order_relaxed) != _flush_done;
+        }
+        // 请求之前的数据都已处理, 执行刷新回调后唤醒等待的线程
+        void finishFlush(size_t flush_req)
+        {
+            if (flush_req == _flush_done)
+                return;
+            if (_flush_cb)
+                _flush_cb();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _flush_done = flush_req;
+            _cond_flush.notify_all();
+        }
+        // 消费者退出时所有数据都已处理, 之后的刷新请求也不需要再等待
+        void finishAll()
+        {
+            if (_flush_cb)
+                _flush_cb();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _exited = true;
+            _cond_flush.notify_all();
+        }
+
+        // 消费者等待数据, 设置了唤醒间隔时超时返回false
+        template <typename Pred>
+        bool waitConsumer(std::unique_lock<std::mutex> &lock, Pred pred)
+        {
+            size_t interval = _interval_ms;
+            if (interval == 0)
+            {
+                _cond_consumer.wait(lock, pred);
+                return true;
+            }
+            return _cond_consumer.wait_for(lock, std::chrono::milliseconds(interval), pred);
+        }
+
+        void threadEntry()
+        {
+            if (_looper_type == LooperType::LOOPER_RING)
+                return threadEntryRing();
+            while (1)
+            {
+                bool tick;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
                     // 如果退出状态为真, 或者生产缓冲区不为空时, 唤醒消费者线程, 否则继续休眠
-                    _cond_consumer.wait(lock, [&]
-                                        { return !_stop || !_buff_producer.empty(); });
-                    // 生产缓冲区有数据, 交换两个缓冲区
-                    //_buff_consumer.swap(_buff_producer);
-                    _buff_producer.swap(_buff_consumer);
-                    // 唤醒生产者
+                    tick = !waitConsumer(lock, [&]
+                                         { return _stop || !_buff_producer.empty() || _spill || flushPending(); });
                 }
-                if (_async_type == AsyncType::ASYNC_SAFE)
-                    _cond_producer.notify_all();
-                // 被唤醒后, 处理消费缓冲区中的数据
-                _callback(_buff_consumer);
-                // std::cout << "readable size = " << _buff_consumer.readableSize() << std::endl;
-                //  重制缓冲区
-                _buff_consumer.reset();
+                if (consumeMutex(tick) < 0)
+                    break;
             }
-            //std::cout << "while exit" << std::endl;
+            finishAll();
         }
 
     private:
-        std::atomic<bool> _stop;                // 判断是否退出
-        std::mutex _mutex;                      // 互斥锁
-        std::condition_variable _cond_consumer; // 消费者的条件变量
-        std::condition_variable _cond_producer; // 生产者的条件变量
-        Buffer _buff_consumer;                  // 消费者的缓冲区
-        Buffer _buff_producer;                  // 生产者的缓冲区
-        std::thread _thread;                    // 创建线程, 用来执行缓冲区的交换
+        std::atomic<bool> _stop;                  // 判断是否退出
+        bool _exited;                             // 消费者线程是否已经退出
+        std::atomic<size_t> _flush_req;           // 最新的刷新请求序号
+        size_t _flush_done;                       // 已经完成的刷新请求序号, 在锁内修改
+        std::atomic<uint64_t> _flush_tail;        // 无锁模式下最新的刷新请求发出时环形缓冲区的预留位置
+        std::condition_variable _cond_flush;      // 等待刷新完成的条件变量
+        std::mutex _mutex;                        // 互斥锁
+        std::condition_variable _cond_consumer;   // 消费者的条件变量
+        std::condition_variable _cond_producer;   // 生产者的条件变量
+        Buffer _buff_consumer;                    // 消费者的缓冲区
+        Buffer _buff_producer;                    // 生产者的缓冲区
+        std::unique_ptr<Buffer> _spill;           // 挂在生产缓冲区之后的大记录
+        size_t _large_size;                       // 超过该长度的记录不写入生产缓冲区
+        std::unique_ptr<RingBuffer> _ring;        // 无锁模式下的环形缓冲区
+        std::atomic<bool> _parked;                // 消费者是否处于休眠(使用执行器时为空闲)状态
+        std::atomic<bool> _tick;                  // 执行器的定时唤醒请求
+        std::atomic<size_t> _interval_ms;         // 消费者定时唤醒间隔
+        size_t _pending_msgs;                     // 生产缓冲区中的日志条数
+        LogLevel::Level _pending_level;           // 生产缓冲区中日志的最高等级
+        LogLevel::Level _spill_level;             // 大记录的日志等级
+        std::atomic<size_t> _dropped_msgs;        // 累计丢弃的日志条数
+        std::atomic<size_t> _dropped_bytes;       // 累计丢弃的字节数
+        std::atomic<size_t> _report_msgs;         // 还未报告的丢弃条数
+        std::atomic<size_t> _report_bytes;        // 还未报告的丢弃字节数
+        std::atomic<size_t> _timeout_ms;          // ASYNC_BLOCK_TIMEOUT的等待时间
+        std::atomic<LogLevel::Level> _drop_level; // ASYNC_DROP_LEVEL下低于该等级的日志会被丢弃
         AsyncType _async_type;
-        functor _callback; // 回调函数
+        LooperType _looper_type;
+        functor _callback;   // 回调函数
+        flusher _flush_cb;             // 刷新回调
+        AsyncExecutor::ptr _executor; // 共享执行器, 为空时使用自己的线程
+        std::thread _thread;           // 创建线程, 用来执行缓冲区的交换
     };
 }
\ No newline at end of file
@@ -1,115 +1,314 @@
 #pragma once
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
 #include <vector>
 #include "util.hpp"
 
 namespace Log
 {
-// buffer容量增长模式:
-// 默认大小为10M, 每次以二倍方式增长, 当达到阈值时, 进行线性增长, 每次增长10M
+// buffer由固定大小的块串联而成, 块从全局块池中获取, 增长时只追加新块, 不拷贝已有数据
+// 默认容量为1M, 超过容量后(不安全模式)继续追加块
 #define BUFFER_DEFAULT_SIZE (1024 * 1024 * 1)
-#define THRESHOLD_SIZE (1024 * 1024 * 8)
-#define LINEAR_GROWTH (1024 * 1024 * 1)
+// 定义LOG_BUFFER_HUGE_PAGES后块大小为2M, 并优先使用大页
+#ifdef LOG_BUFFER_HUGE_PAGES
+#define BUFFER_CHUNK_SIZE (1024 * 1024 * 2)
+#else
+#define BUFFER_CHUNK_SIZE (1024 * 256)
+#endif
+// 块池最多缓存的空闲块数量, 超出的块直接归还给系统
+#define BUFFER_POOL_IDLE 32
+
+    // 全局的块池, 空闲块通过块内存本身串成链表, 获取和归还都不会分配额外的内存
+    class ChunkPool
+    {
+        struct FreeChunk
+        {
+            FreeChunk *_next;
+        };
+
+    public:
+        // 块池不析构, 保证其他全局对象析构时依然可以归还块
+        static ChunkPool &instance()
+        {
+            static ChunkPool *pool = new ChunkPool();
+            return *pool;
+        }
+
+        // 获取一个BUFFER_CHUNK_SIZE大小的块
+        char *acquire()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_free != nullptr)
+                {
+                    FreeChunk *chunk = _free;
+                    _free = chunk->_next;
+                    --_idle;
+                    return reinterpret_cast<char *>(chunk);
+                }
+            }
+            return allocate(BUFFER_CHUNK_SIZE);
+        }
+        void release(char *data)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_idle < BUFFER_POOL_IDLE)
+                {
+                    FreeChunk *chunk = reinterpret_cast<FreeChunk *>(data);
+                    chunk->_next = _free;
+                    _free = chunk;
+                    ++_idle;
+                    return;
+                }
+            }
+            deallocate(data, BUFFER_CHUNK_SIZE);
+        }
+        // 当前缓存的空闲块数量
+        size_t idle()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _idle;
+        }
+
+        // 直接向系统申请内存, 超过块大小的大记录也通过这里单独分配
+        static char *allocate(size_t size)
+        {
+            void *p = MAP_FAILED;
+#ifdef LOG_BUFFER_HUGE_PAGES
+            // 预留的大页不足时退回普通页, 再建议内核使用透明大页
+            if (size % BUFFER_CHUNK_SIZE == 0)
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED)
+                    madvise(p, size, MADV_HUGEPAGE);
+            }
+#else
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+            return static_cast<char *>(p);
+        }
+        static void deallocate(char *data, size_t size)
+        {
+            munmap(data, size);
+        }
+
+    private:
+        ChunkPool() : _free(nullptr), _idle(0) {}
+
+    private:
+        std::mutex _mutex;
+        FreeChunk *_free; // 空闲块链表
+        size_t _idle;     // 空闲块数量
+    };
+
     class Buffer
     {
+        struct Chunk
+        {
+            char *_data;
+            size_t _cap;
+            size_t _read;  // 块内的读取位置
+            size_t _write; // 块内的写入位置
+            bool _pooled;  // 是否来自块池, 否则是为大记录单独分配的
+        };
+
     public:
-        Buffer()
-            : _reader_pos(0), _writer_pos(0), _buffer(BUFFER_DEFAULT_SIZE)
+        // size是缓冲区的容量, 只用于计算可写空间, 块在写入时才获取
+        Buffer(size_t size = BUFFER_DEFAULT_SIZE)
+            : _limit(size), _size(0)
+        {
+            // 预留块描述的空间, 正常情况下写入时不再分配内存
+            _chunks.reserve(size / BUFFER_CHUNK_SIZE + 2);
+        }
+        ~Buffer()
         {
+            release(0);
         }
-        // 写入缓冲区
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        // 写入缓冲区, 一次写入的数据总是位于同一个块中
         void push(const char *data, size_t len)
         {
-            // 判断是否需要扩容, 如果不需要, 正常插入数据
-            //assert(len <= writeableSize());
-            expandCapacity(len);
-            //std::cout << "buffer::push len = " << len << std::endl;
-            std::copy(data, data + len, &_buffer[_writer_pos]);
-            //std::cout << data;
-            // 移动写入指针
-            //std::cout << "copy success" << std::endl;
+            if (len == 0)
+                return;
+            reserve(len);
+            memcpy(writePtr(), data, len);
             moveWriter(len);
-            //std::cout << "write pos = " << _writer_pos << std::endl;
         }
         // 移动读指针
         void moveReader(size_t len)
         {
-            _reader_pos += len;
+            _size -= len;
+            for (auto &chunk : _chunks)
+            {
+                size_t n = std::min(len, chunk._write - chunk._read);
+                chunk._read += n;
+                len -= n;
+                if (len == 0)
+                    break;
+            }
         }
         void moveWriter(size_t len)
         {
-            _writer_pos += len;
+            _chunks.back()._write += len;
+            _size += len;
         }
         void getPtrPos()
         {
-            std::cout << "_writepos = " << _writer_pos << std::endl;
-            std::cout << "_readpos = " << _reader_pos << std::endl;
+            std::cout << "_chunks = " << _chunks.size() << std::endl;
+            std::cout << "_size = " << _size << std::endl;
         }
         // 判空
         bool empty()
         {
-            return _reader_pos == _writer_pos;
+            return _size == 0;
         }
-        // 重制
+        // 重置, 突发流量之后多出来的块归还给块池, 只保留第一个块
         void reset()
         {
-            _reader_pos = _writer_pos = 0;
+            release(1);
+            _size = 0;
+            if (!_chunks.empty())
+                _chunks[0]._read = _chunks[0]._write = 0;
         }
         void swap(Buffer &buff)
         {
-            _buffer.swap(buff._buffer);
-            std::swap(_reader_pos, buff._reader_pos);
-            std::swap(_writer_pos, buff._writer_pos);
+            _chunks.swap(buff._chunks);
+            std::swap(_limit, buff._limit);
+            std::swap(_size, buff._size);
         }
-        // 返回可写空间大小
+        // 返回可写空间大小(按容量计算, 超过容量后依然可以继续写入)
         size_t writeableSize()
         {
-            //std::cout << "writeableSize = " << _buffer.size() - _writer_pos << std::endl;
-            return _buffer.size() - _writer_pos;
+            return _limit > _size ? _limit - _size : 0;
         }
         // 返回可读数据大小
         size_t readableSize()
         {
-            //std::cout << "read pos = " << _reader_pos << std::endl;
-            // std::cout << "write pos = " << _writer_pos << std::endl;
-            return _writer_pos - _reader_pos;
+            return _size;
         }
 
+        // 返回连续的可读数据, 数据分布在多个块中时先合并到一个块
         const char *begin()
         {
-            return &_buffer[_reader_pos];
+            if (_chunks.empty())
+                return "";
+            if (_chunks.size() > 1)
+                linearize();
+            return _chunks[0]._data + _chunks[0]._read;
+        }
+        // 可写区域的起始位置, 直接写入后需要调用moveWriter
+        char *writePtr()
+        {
+            if (_chunks.empty())
+                reserve(1);
+            return _chunks.back()._data + _chunks.back()._write;
+        }
+        // writePtr之后连续可写的字节数
+        size_t contiguousSize()
+        {
+            if (_chunks.empty())
+                return 0;
+            return _chunks.back()._cap - _chunks.back()._write;
+        }
+        // 保证writePtr之后至少有len字节的连续可写空间, 当前块剩余空间不足时追加新块
+        void reserve(size_t len)
+        {
+            if (contiguousSize() >= len)
+                return;
+            Chunk chunk;
+            chunk._read = chunk._write = 0;
+            chunk._pooled = len <= BUFFER_CHUNK_SIZE;
+            chunk._cap = chunk._pooled ? BUFFER_CHUNK_SIZE : len;
+            chunk._data = chunk._pooled ? ChunkPool::instance().acquire() : ChunkPool::allocate(len);
+            if (!_chunks.empty() && _chunks.back()._write == 0)
+            {
+                // 当前块还没有写入数据, 直接替换掉
+                releaseChunk(_chunks.back());
+                _chunks.back() = chunk;
+                return;
+            }
+            _chunks.push_back(chunk);
+        }
+
+        // 以iovec的形式依次追加所有可读的数据段, 每一段都包含若干次完整的写入
+        void segments(std::vector<struct iovec> &iov)
+        {
+            for (auto &chunk : _chunks)
+            {
+                if (chunk._write == chunk._read)
+                    continue;
+                struct iovec seg;
+                seg.iov_base = chunk._data + chunk._read;
+                seg.iov_len = chunk._write - chunk._read;
+                iov.push_back(seg);
+            }
+        }
+        // 依次对每一段可读数据调用f(data, len), 不分配内存, 崩溃处理时也可以使用
+        template <typename F>
+        void forEachSegment(F &f)
+        {
+            for (auto &chunk : _chunks)
+            {
+                if (chunk._write != chunk._read)
+                    f(chunk._data + chunk._read, chunk._write - chunk._read);
+            }
         }
 
         std::string getReadableData()
         {
             std::string ret;
-            std::copy(&_buffer[_reader_pos], &_buffer[_reader_pos]+readableSize(), &ret[0]);
-            std::cout << ret;
+            ret.reserve(_size);
+            for (auto &chunk : _chunks)
+                ret.append(chunk._data + chunk._read, chunk._write - chunk._read);
             return ret;
         }
+
     private:
-        void expandCapacity(size_t len)
+        void linearize()
         {
-            if (len < writeableSize())
-                return; // 空间足够
-            size_t new_size = 0;
-            if (_buffer.size() < THRESHOLD_SIZE)
+            Buffer tmp(_limit);
+            tmp.reserve(std::max(_size, (size_t)1));
+            for (auto &chunk : _chunks)
             {
-                // 小于阈值时, 翻倍增长
-                new_size = _buffer.size() * 2 + len;
+                memcpy(tmp.writePtr(), chunk._data + chunk._read, chunk._write - chunk._read);
+                tmp.moveWriter(chunk._write - chunk._read);
             }
+            swap(tmp);
+        }
+        // 释放第keep个之后的所有块
+        void release(size_t keep)
+        {
+            // 单独分配的大块不保留
+            if (keep > 0 && !_chunks.empty() && !_chunks[0]._pooled)
+                keep = 0;
+            for (size_t i = keep; i < _chunks.size(); ++i)
+                releaseChunk(_chunks[i]);
+            if (_chunks.size() > keep)
+                _chunks.resize(keep);
+        }
+        static void releaseChunk(Chunk &chunk)
+        {
+            if (chunk._pooled)
+                ChunkPool::instance().release(chunk._data);
             else
-            {
-                // 大于阈值时, 线性增长
-                new_size = _buffer.size() + LINEAR_GROWTH + len;
-            }
-            //std::cout << "new size = " << new_size << std::endl;
-            _buffer.resize(new_size);
-            //std::cout << "buffer.size = " << _buffer.size() << std::endl;
+                ChunkPool::deallocate(chunk._data, chunk._cap);
         }
 
     private:
-        std::vector<char> _buffer;
-        size_t _reader_pos; // 读取位置指针
-        size_t _writer_pos; // 写入位置指针
+        std::vector<Chunk> _chunks; // 按写入顺序排列的块, 只在最后一个块中写入
+        size_t _limit;              // 缓冲区容量
+        size_t _size;               // 可读数据大小
     };
 }
\ No newline at end of file
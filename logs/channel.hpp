@@ -0,0 +1,261 @@
+#pragma once
+#include <deque>
+#include "out.hpp"
+#include "async.hpp"
+
+namespace Log
+{
+// 输出独立队列的默认容量
+#define CHANNEL_DEFAULT_SIZE (1024 * 1024 * 8)
+
+    // 多个输出共享的一批格式化后的日志, 最后一个输出写完后释放, 块归还给块池
+    struct OutputBatch
+    {
+        using ptr = std::shared_ptr<OutputBatch>;
+        OutputBatch(LogLevel::Level level)
+            : _level(level) {}
+
+        Buffer _buff;           // 这一批的数据
+        LogLevel::Level _level; // 这一批中日志的最高等级
+    };
+
+    // 输出独立队列的配置, max_bytes为0表示该输出在异步线程中直接写入
+    struct ChannelConfig
+    {
+        ChannelConfig(size_t max_bytes = 0,
+                      AsyncType type = AsyncType::ASYNC_SAFE,
+                      size_t timeout_ms = ASYNC_DEFAULT_TIMEOUT,
+                      LogLevel::Level drop_level = LogLevel::Level::WARNING)
+            : _max_bytes(max_bytes), _type(type), _timeout_ms(timeout_ms), _drop_level(drop_level) {}
+
+        size_t _max_bytes;           // 队列中最多排队的字节数
+        AsyncType _type;             // 队列满时的处理策略
+        size_t _timeout_ms;          // ASYNC_BLOCK_TIMEOUT的等待时间
+        LogLevel::Level _drop_level; // ASYNC_DROP_LEVEL下低于该等级的批次会被丢弃
+    };
+
+    // 单个输出的独立消费者: 拥有自己的队列和背压策略, 慢的输出不会拖慢其他输出
+    // 队列中保存共享的批次, 多个输出之间不拷贝数据; 由共享执行器调度, 没有指定时使用自己的单线程执行器
+    // 写入方会阻塞等待队列的空间和刷新, 因此指定的执行器不能同时调度写入方自己
+    class OutputChannel : public ExecutorTask
+    {
+    public:
+        using ptr = std::shared_ptr<OutputChannel>;
+        OutputChannel(const Output::ptr &out, const ChannelConfig &config,
+                      const AsyncExecutor::ptr &executor = AsyncExecutor::ptr())
+            : _out(out),
+              _config(config),
+              _executor(executor ? executor : std::make_shared<AsyncExecutor>(1)),
+              _queued_bytes(0),
+              _stop(false),
+              _exited(false),
+              _parked(true),
+              _tick(false),
+              _flush_req(0),
+              _flush_done(0),
+              _dropped_batches(0),
+              _dropped_bytes(0)
+        {
+            _executor->add(this);
+        }
+        ~OutputChannel()
+        {
+            stop();
+        }
+        // 写完队列中剩余的数据后停止
+        void stop()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_stop)
+                return;
+            _stop = true;
+            wake();
+            _cond_done.wait(lock, [&]
+                            { return _exited; });
+            lock.unlock();
+            _executor->remove(this);
+        }
+
+        // 由异步线程调用, 按照策略等待队列中有足够的空间, 被丢弃时返回false
+        // force为真时不受容量限制, 用于日志器自己产生的说明
+        bool push(const OutputBatch::ptr &batch, bool force = false)
+        {
+            size_t len = batch->_buff.readableSize();
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!force && !reserve(lock, len, batch->_level))
+            {
+                ++_dropped_batches;
+                _dropped_bytes += len;
+                return false;
+            }
+            _queue.push_back(batch);
+            _queued_bytes += len;
+            wake();
+            return true;
+        }
+        // 写完当前排队的数据后刷新输出, 不等待
+        void requestFlush()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_flush_req;
+            wake();
+        }
+        // 等待当前排队的数据写完并刷新输出, timeout_ms为0时一直等待, 超时返回false
+        bool flush(size_t timeout_ms = 0)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            size_t id = ++_flush_req;
+            wake();
+            auto done = [&]
+            { return _flush_done >= id || _exited; };
+            if (timeout_ms == 0)
+            {
+                _cond_done.wait(lock, done);
+                return true;
+            }
+            return _cond_done.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+        }
+        // 取出上次报告之后丢弃的批次数和字节数, 没有丢弃时返回false
+        bool takeDropped(size_t &batches, size_t &bytes)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_dropped_batches == 0)
+                return false;
+            batches = _dropped_batches;
+            bytes = _dropped_bytes;
+            _dropped_batches = _dropped_bytes = 0;
+            return true;
+        }
+        // 进程崩溃时由信号处理函数调用, 不加锁地对还没有写完的数据依次调用f(data, len)
+        template <typename F>
+        void drainUnsafe(F &f)
+        {
+            for (auto &batch : _writing)
+                batch->_buff.forEachSegment(f);
+            for (auto &batch : _queue)
+                batch->_buff.forEachSegment(f);
+        }
+
+        bool runOnce()
+        {
+            size_t flush_req;
+            bool tick;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                bool ready = !_queue.empty() || _flush_req != _flush_done;
+                if (_stop && !ready)
+                {
+                    // 退出之后不再访问任何成员, 等待退出的线程随时可能析构这里
+                    _exited = true;
+                    _cond_done.notify_all();
+                    return false;
+                }
+                if (!ready && !_tick)
+                {
+                    _parked = true;
+                    return false;
+                }
+                _writing.swap(_queue);
+                _queued_bytes = 0;
+                flush_req = _flush_req;
+                tick = _tick;
+                _tick = false;
+            }
+            _cond_space.notify_all();
+            for (auto &batch : _writing)
+            {
+                _iov.clear();
+                batch->_buff.segments(_iov);
+                _out->logv(_iov.data(), _iov.size());
+                _out->commit(batch->_buff.readableSize(), batch->_level);
+            }
+            // 按时间间隔同步的输出在没有新数据时也需要检查一次
+            if (tick && _writing.empty())
+                _out->commit(0, LogLevel::Level::UNKNOW);
+            _writing.clear();
+            if (flush_req != _flush_done)
+            {
+                _out->flush();
+                std::unique_lock<std::mutex> lock(_mutex);
+                _flush_done = flush_req;
+                _cond_done.notify_all();
+            }
+            return true;
+        }
+        size_t tickInterval()
+        {
+            return _out->syncInterval();
+        }
+        void tick()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _tick = true;
+            wake();
+        }
+
+    private:
+        bool reserve(std::unique_lock<std::mutex> &lock, size_t len, LogLevel::Level level)
+        {
+            // 队列为空时总是可以写入, 超过容量的单个批次也不会永久阻塞
+            auto writeable = [&]
+            { return _queue.empty() || _queued_bytes + len <= _config._max_bytes; };
+            switch (_config._type)
+            {
+            case AsyncType::ASYNC_UNSAFE:
+                return true;
+            case AsyncType::ASYNC_BLOCK_TIMEOUT:
+                return _cond_space.wait_for(lock, std::chrono::milliseconds(_config._timeout_ms), writeable);
+            case AsyncType::ASYNC_DROP_NEWEST:
+                return writeable();
+            case AsyncType::ASYNC_DROP_OLDEST:
+                // 丢弃最早排队的批次, 腾出空间写入新的批次
+                while (!writeable())
+                {
+                    size_t n = _queue.front()->_buff.readableSize();
+                    ++_dropped_batches;
+                    _dropped_bytes += n;
+                    _queued_bytes -= n;
+                    _queue.pop_front();
+                }
+                return true;
+            case AsyncType::ASYNC_DROP_LEVEL:
+                if (level < _config._drop_level)
+                    return writeable();
+                break;
+            default:
+                break;
+            }
+            _cond_space.wait(lock, writeable);
+            return true;
+        }
+        // 空闲状态的队列有新的数据或请求时加入执行器的就绪队列, 调用时持有_mutex
+        void wake()
+        {
+            if (_parked)
+            {
+                _parked = false;
+                _executor->schedule(this);
+            }
+        }
+
+    private:
+        Output::ptr _out;
+        ChannelConfig _config;
+        AsyncExecutor::ptr _executor;
+        std::mutex _mutex;
+        std::condition_variable _cond_space;    // 等待队列中有空间
+        std::condition_variable _cond_done;     // 等待刷新完成或退出
+        std::deque<OutputBatch::ptr> _queue;    // 排队的批次
+        std::deque<OutputBatch::ptr> _writing;  // 正在写入的批次, 只由执行器访问
+        std::vector<struct iovec> _iov;         // 交给输出的数据段
+        size_t _queued_bytes;                   // 排队的字节数
+        bool _stop;                             // 是否停止
+        bool _exited;                           // 是否已经写完所有数据
+        bool _parked;                           // 是否处于空闲状态(不在执行器的就绪队列中)
+        bool _tick;                             // 执行器的定时唤醒请求
+        size_t _flush_req;                      // 最新的刷新请求序号
+        size_t _flush_done;                     // 已经完成的刷新请求序号
+        size_t _dropped_batches;                // 还未报告的丢弃批次数
+        size_t _dropped_bytes;                  // 还未报告的丢弃字节数
+    };
+}
\ No newline at end of file
@@ -0,0 +1,583 @@
+#pragma once
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "file.hpp"
+#ifdef LOG_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LOG_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace Log
+{
+// 压缩时每次读取的数据量, 也是内置LZ编码的块大小
+#define COMPRESS_CHUNK_SIZE (1024 * 256)
+    // 滚动后旧文件的压缩方式
+    enum CompressCodec
+    {
+        CODEC_NONE, // 不压缩
+        CODEC_LZ,   // 内置的LZ编码, 速度快, 不依赖外部库
+        CODEC_GZIP, // 需要定义LOG_WITH_ZLIB并链接-lz, 否则使用CODEC_LZ
+        CODEC_ZSTD, // 需要定义LOG_WITH_ZSTD并链接-lzstd, 否则使用CODEC_LZ
+    };
+
+    // 流式压缩器, 依次输入文件的各段数据, 压缩结果追加到out中
+    class Codec
+    {
+    public:
+        using ptr = std::unique_ptr<Codec>;
+        virtual ~Codec() {}
+        // last为真表示这是最后一段数据, 需要输出所有剩余的结果, 出错时返回false
+        virtual bool update(const char *data, size_t len, std::string &out, bool last) = 0;
+        // 压缩后文件名的后缀
+        virtual const char *suffix() = 0;
+
+        // 编译时没有对应的库时退回到内置的LZ编码
+        static CompressCodec resolve(CompressCodec codec)
+        {
+#ifndef LOG_WITH_ZLIB
+            if (codec == CompressCodec::CODEC_GZIP)
+                return CompressCodec::CODEC_LZ;
+#endif
+#ifndef LOG_WITH_ZSTD
+            if (codec == CompressCodec::CODEC_ZSTD)
+                return CompressCodec::CODEC_LZ;
+#endif
+            return codec;
+        }
+        static Codec::ptr create(CompressCodec codec);
+    };
+
+    // 内置的LZ编码, 格式与LZ4的块格式类似:
+    // 文件以"LZLG"开头, 之后是若干块, 每块为 原始长度(4字节) | 压缩长度(4字节) | 数据, 两个长度相等时数据未压缩
+    // 块内是若干序列: 标记(高4位字面量长度, 低4位匹配长度-4) | 扩展字面量长度 | 字面量 | 偏移(2字节) | 扩展匹配长度
+    // 最后一个序列只有字面量; 长度为15时后面跟若干字节继续累加, 直到某个字节小于255
+    class LzCodec : public Codec
+    {
+        static const size_t MIN_MATCH = 4;
+        static const size_t HASH_BITS = 14;
+        static const size_t MAX_OFFSET = 65535;
+        static const size_t LAST_LITERALS = 5; // 块末尾的若干字节总是作为字面量, 匹配时不会越界读取
+
+    public:
+        LzCodec()
+            : _header(false), _table(1 << HASH_BITS) {}
+        bool update(const char *data, size_t len, std::string &out, bool)
+        {
+            if (!_header)
+            {
+                out.append("LZLG", 4);
+                _header = true;
+            }
+            while (len > 0)
+            {
+                size_t n = std::min(len, (size_t)COMPRESS_CHUNK_SIZE);
+                compressBlock(reinterpret_cast<const uint8_t *>(data), n, out);
+                data += n;
+                len -= n;
+            }
+            return true;
+        }
+        const char *suffix()
+        {
+            return ".lz";
+        }
+
+        // 解压整个文件的内容, 格式错误时返回false
+        static bool decompress(const std::string &in, std::string &out)
+        {
+            if (in.size() < 4 || in.compare(0, 4, "LZLG") != 0)
+                return false;
+            size_t pos = 4;
+            while (pos < in.size())
+            {
+                if (in.size() - pos < 8)
+                    return false;
+                uint32_t raw = readU32(in.data() + pos);
+                uint32_t comp = readU32(in.data() + pos + 4);
+                pos += 8;
+                if (in.size() - pos < comp)
+                    return false;
+                if (raw == comp)
+                    out.append(in, pos, comp);
+                else if (!decompressBlock(reinterpret_cast<const uint8_t *>(in.data() + pos), comp, raw, out))
+                    return false;
+                pos += comp;
+            }
+            return true;
+        }
+
+    private:
+        void compressBlock(const uint8_t *src, size_t len, std::string &out)
+        {
+            size_t start = out.size();
+            out.append(8, '\0');
+            std::fill(_table.begin(), _table.end(), 0);
+            size_t anchor = 0; // 还没有输出的字面量的起点
+            size_t i = 0;
+            while (len >= LAST_LITERALS + MIN_MATCH && i + MIN_MATCH + LAST_LITERALS <= len)
+            {
+                uint32_t seq = load32(src + i);
+                uint32_t &slot = _table[hash(seq)];
+                size_t cand = slot; // 表中保存位置+1, 0表示空
+                slot = (uint32_t)(i + 1);
+                if (cand == 0 || i - (cand - 1) > MAX_OFFSET || load32(src + cand - 1) != seq)
+                {
+                    ++i;
+                    continue;
+                }
+                size_t ref = cand - 1;
+                size_t limit = len - LAST_LITERALS;
+                size_t mlen = MIN_MATCH;
+                while (i + mlen < limit && src[ref + mlen] == src[i + mlen])
+                    ++mlen;
+                emitSequence(src + anchor, i - anchor, i - ref, mlen, out);
+                i += mlen;
+                anchor = i;
+            }
+            emitLiterals(src + anchor, len - anchor, out);
+            size_t comp = out.size() - start - 8;
+            if (comp >= len)
+            {
+                // 数据无法压缩时原样保存
+                out.resize(start + 8);
+                out.append(reinterpret_cast<const char *>(src), len);
+                comp = len;
+            }
+            writeU32(&out[start], (uint32_t)len);
+            writeU32(&out[start + 4], (uint32_t)comp);
+        }
+        static void emitSequence(const uint8_t *lit, size_t lit_len, size_t offset, size_t mlen, std::string &out)
+        {
+            size_t m = mlen - MIN_MATCH;
+            out.push_back((char)((std::min(lit_len, (size_t)15) << 4) | std::min(m, (size_t)15)));
+            if (lit_len >= 15)
+                writeLength(lit_len - 15, out);
+            out.append(reinterpret_cast<const char *>(lit), lit_len);
+            out.push_back((char)(offset & 0xff));
+            out.push_back((char)(offset >> 8));
+            if (m >= 15)
+                writeLength(m - 15, out);
+        }
+        static void emitLiterals(const uint8_t *lit, size_t lit_len, std::string &out)
+        {
+            out.push_back((char)(std::min(lit_len, (size_t)15) << 4));
+            if (lit_len >= 15)
+                writeLength(lit_len - 15, out);
+            out.append(reinterpret_cast<const char *>(lit), lit_len);
+        }
+        static void writeLength(size_t n, std::string &out)
+        {
+            while (n >= 255)
+            {
+                out.push_back((char)255);
+                n -= 255;
+            }
+            out.push_back((char)n);
+        }
+        static bool readLength(const uint8_t *&p, const uint8_t *end, size_t &n)
+        {
+            uint8_t b;
+            do
+            {
+                if (p >= end)
+                    return false;
+                b = *p++;
+                n += b;
+            } while (b == 255);
+            return true;
+        }
+        static bool decompressBlock(const uint8_t *p, size_t len, size_t raw, std::string &out)
+        {
+            const uint8_t *end = p + len;
+            size_t base = out.size();
+            while (p < end)
+            {
+                uint8_t token = *p++;
+                size_t lit_len = token >> 4;
+                if (lit_len == 15 && !readLength(p, end, lit_len))
+                    return false;
+                if ((size_t)(end - p) < lit_len)
+                    return false;
+                out.append(reinterpret_cast<const char *>(p), lit_len);
+                p += lit_len;
+                if (p == end)
+                    break; // 最后一个序列只有字面量
+                if (end - p < 2)
+                    return false;
+                size_t offset = p[0] | (p[1] << 8);
+                p += 2;
+                size_t mlen = token & 15;
+                if (mlen == 15 && !readLength(p, end, mlen))
+                    return false;
+                mlen += MIN_MATCH;
+                if (offset == 0 || offset > out.size() - base)
+                    return false;
+                // 匹配可能与自身重叠, 逐字节拷贝
+                size_t from = out.size() - offset;
+                for (size_t k = 0; k < mlen; ++k)
+                    out.push_back(out[from + k]);
+            }
+            return out.size() - base == raw;
+        }
+
+        static uint32_t load32(const uint8_t *p)
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        static size_t hash(uint32_t v)
+        {
+            return (v * 2654435761U) >> (32 - HASH_BITS);
+        }
+        static uint32_t readU32(const char *p)
+        {
+            const uint8_t *b = reinterpret_cast<const uint8_t *>(p);
+            return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+        }
+        static void writeU32(char *p, uint32_t v)
+        {
+            for (int k = 0; k < 4; ++k)
+                p[k] = (char)(v >> (8 * k));
+        }
+
+    private:
+        bool _header;                 // 是否已经输出文件头
+        std::vector<uint32_t> _table; // 4字节序列的哈希 -> 最近出现的位置+1
+    };
+
+#ifdef LOG_WITH_ZLIB
+    // gzip格式, 可以直接用gunzip/zcat查看
+    class GzipCodec : public Codec
+    {
+    public:
+        GzipCodec()
+        {
+            memset(&_strm, 0, sizeof(_strm));
+            // windowBits加16表示输出gzip的头部和尾部
+            _ok = deflateInit2(&_strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+        ~GzipCodec()
+        {
+            if (_ok)
+                deflateEnd(&_strm);
+        }
+        bool update(const char *data, size_t len, std::string &out, bool last)
+        {
+            if (!_ok)
+                return false;
+            char buf[COMPRESS_CHUNK_SIZE / 4];
+            _strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            _strm.avail_in = (uInt)len;
+            int flush = last ? Z_FINISH : Z_NO_FLUSH;
+            int ret;
+            do
+            {
+                _strm.next_out = reinterpret_cast<Bytef *>(buf);
+                _strm.avail_out = sizeof(buf);
+                ret = deflate(&_strm, flush);
+                if (ret == Z_STREAM_ERROR)
+                    return false;
+                out.append(buf, sizeof(buf) - _strm.avail_out);
+            } while (_strm.avail_out == 0 || (last && ret != Z_STREAM_END));
+            return true;
+        }
+        const char *suffix()
+        {
+            return ".gz";
+        }
+
+    private:
+        z_stream _strm;
+        bool _ok;
+    };
+#endif
+
+#ifdef LOG_WITH_ZSTD
+    // zstd格式, 可以直接用zstd -d查看
+    class ZstdCodec : public Codec
+    {
+    public:
+        ZstdCodec()
+            : _cctx(ZSTD_createCCtx())
+        {
+            if (_cctx != nullptr)
+                ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, 3);
+        }
+        ~ZstdCodec()
+        {
+            ZSTD_freeCCtx(_cctx);
+        }
+        bool update(const char *data, size_t len, std::string &out, bool last)
+        {
+            if (_cctx == nullptr)
+                return false;
+            char buf[COMPRESS_CHUNK_SIZE / 4];
+            ZSTD_inBuffer in = {data, len, 0};
+            ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+            size_t remaining;
+            do
+            {
+                ZSTD_outBuffer obuf = {buf, sizeof(buf), 0};
+                remaining = ZSTD_compressStream2(_cctx, &obuf, &in, mode);
+                if (ZSTD_isError(remaining))
+                    return false;
+                out.append(buf, obuf.pos);
+            } while (last ? remaining != 0 : in.pos != in.size);
+            return true;
+        }
+        const char *suffix()
+        {
+            return ".zst";
+        }
+
+    private:
+        ZSTD_CCtx *_cctx;
+    };
+#endif
+
+    inline Codec::ptr Codec::create(CompressCodec codec)
+    {
+        switch (resolve(codec))
+        {
+#ifdef LOG_WITH_ZLIB
+        case CompressCodec::CODEC_GZIP:
+            return Codec::ptr(new GzipCodec());
+#endif
+#ifdef LOG_WITH_ZSTD
+        case CompressCodec::CODEC_ZSTD:
+            return Codec::ptr(new ZstdCodec());
+#endif
+        case CompressCodec::CODEC_LZ:
+            return Codec::ptr(new LzCodec());
+        default:
+            return Codec::ptr();
+        }
+    }
+
+    // 压缩的累计统计
+    struct CompressStats
+    {
+        size_t _files = 0;     // 压缩完成的文件数
+        size_t _failed = 0;    // 压缩失败的文件数, 失败时保留原文件
+        size_t _skipped = 0;   // 压缩前原文件已经被删除(例如被保留策略清理)的文件数
+        size_t _raw_bytes = 0; // 压缩前的总字节数
+        size_t _out_bytes = 0; // 压缩后的总字节数
+        size_t _cpu_us = 0;    // 压缩线程消耗的CPU时间(微秒)
+
+        // 压缩率: 压缩后大小 / 压缩前大小
+        double ratio() const
+        {
+            return _raw_bytes == 0 ? 0 : (double)_out_bytes / _raw_bytes;
+        }
+    };
+
+    // 滚动输出的后台压缩线程, 滚动时只把已经关闭的文件名放入队列, 不会阻塞写入线程
+    // 压缩线程使用SCHED_IDLE调度和空闲的IO优先级, 只占用空闲的CPU和磁盘带宽
+    // 压缩结果先写入临时文件, 成功后改名并删除原文件, 中途失败或进程退出时原文件保持不变
+    class Compressor
+    {
+    public:
+        using ptr = std::shared_ptr<Compressor>;
+        Compressor()
+            : _stop(false), _busy(false)
+        {
+            _thread = std::thread(&Compressor::threadEntry, this);
+            pthread_setname_np(_thread.native_handle(), "log-compress");
+        }
+        // 压缩完队列中剩余的文件后退出
+        ~Compressor()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _thread.join();
+        }
+        // 所有滚动输出默认共享的压缩线程
+        static Compressor::ptr instance()
+        {
+            static Compressor::ptr compressor = std::make_shared<Compressor>();
+            return compressor;
+        }
+
+        // 压缩结束后在压缩线程中调用done(原文件名, 压缩后的文件名, 是否成功)
+        using Callback = std::function<void(const std::string &, const std::string &, bool)>;
+        // 将一个已经关闭的文件加入压缩队列
+        void submit(const std::string &pathname, CompressCodec codec, const Callback &done = Callback())
+        {
+            if (codec == CompressCodec::CODEC_NONE)
+                return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobs.push_back(Job{pathname, codec, done});
+            _cond.notify_all();
+        }
+        // 等待队列中的文件全部压缩完成
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond_idle.wait(lock, [&]
+                            { return _jobs.empty() && !_busy; });
+        }
+        CompressStats stats()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _stats;
+        }
+
+        // 降低当前后台线程的CPU和IO优先级, 失败时保持默认优先级
+        static void lowerPriority()
+        {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+                setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+            // IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, 类别在第13位之后
+            syscall(SYS_ioprio_set, 1, (int)syscall(SYS_gettid), 3 << 13);
+#endif
+        }
+
+    private:
+        struct Job
+        {
+            std::string _pathname;
+            CompressCodec _codec;
+            Callback _done;
+        };
+
+        void threadEntry()
+        {
+            lowerPriority();
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _cond.wait(lock, [&]
+                           { return _stop || !_jobs.empty(); });
+                if (_jobs.empty())
+                    break;
+                Job job = _jobs.front();
+                _jobs.pop_front();
+                _busy = true;
+                lock.unlock();
+                size_t raw = 0, out = 0;
+                std::string target;
+                size_t start = cpuUs();
+                bool ok = compressFile(job, target, raw, out);
+                bool missing = !ok && target.empty() && errno == ENOENT;
+                size_t cpu = cpuUs() - start;
+                if (job._done)
+                    job._done(job._pathname, target, ok);
+                lock.lock();
+                _busy = false;
+                if (ok)
+                {
+                    ++_stats._files;
+                    _stats._raw_bytes += raw;
+                    _stats._out_bytes += out;
+                }
+                else if (missing)
+                {
+                    ++_stats._skipped;
+                }
+                else
+                {
+                    ++_stats._failed;
+                    std::cout << "压缩滚动文件失败: " << job._pathname << std::endl;
+                }
+                _stats._cpu_us += cpu;
+                if (_jobs.empty())
+                    _cond_idle.notify_all();
+            }
+            _cond_idle.notify_all();
+        }
+
+        static bool compressFile(const Job &job, std::string &target, size_t &raw, size_t &out)
+        {
+            Codec::ptr codec = Codec::create(job._codec);
+            if (!codec)
+                return false;
+            int in_fd = ::open(job._pathname.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in_fd < 0)
+                return false; // target为空, 由errno区分原文件不存在和其他错误
+            target = job._pathname + codec->suffix();
+            std::string tmp = target + ".tmp";
+            int out_fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (out_fd < 0)
+            {
+                ::close(in_fd);
+                return false;
+            }
+            std::unique_ptr<char[]> buf(new char[COMPRESS_CHUNK_SIZE]);
+            std::string result;
+            bool ok = true;
+            while (ok)
+            {
+                ssize_t n = ::read(in_fd, buf.get(), COMPRESS_CHUNK_SIZE);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                {
+                    ok = false;
+                    break;
+                }
+                result.clear();
+                ok = codec->update(buf.get(), n, result, n == 0) &&
+                     LogFile::writeAll(out_fd, result.data(), result.size());
+                raw += n;
+                out += result.size();
+                if (n == 0)
+                    break;
+            }
+            ::close(in_fd);
+            // 改名前同步到磁盘, 防止掉电后只剩下不完整的压缩文件
+            ok = ::fsync(out_fd) == 0 && ok;
+            ok = ::close(out_fd) == 0 && ok;
+            if (ok && ::rename(tmp.c_str(), target.c_str()) == 0)
+            {
+                ::unlink(job._pathname.c_str());
+                return true;
+            }
+            ::unlink(tmp.c_str());
+            return false;
+        }
+
+        static size_t cpuUs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+
+    private:
+        bool _stop;
+        bool _busy;                         // 是否正在压缩
+        std::mutex _mutex;
+        std::condition_variable _cond;      // 压缩线程等待新的文件
+        std::condition_variable _cond_idle; // 等待队列中的文件压缩完成
+        std::deque<Job> _jobs;              // 等待压缩的文件
+        CompressStats _stats;               // 累计统计
+        std::thread _thread;
+    };
+}
\ No newline at end of file
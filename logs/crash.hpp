@@ -0,0 +1,189 @@
+#pragma once
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+
+namespace Log
+{
+// 崩溃处理最多登记的日志器数量, 超出的日志器在崩溃时不会被排空
+#define CRASH_MAX_LOGGERS 64
+// 崩溃记录中回溯的最大层数
+#define CRASH_MAX_FRAMES 64
+
+    // 可选的崩溃处理: 进程因为SIGSEGV, SIGABRT等信号崩溃时, 将各日志器还没有输出的数据写到输出中
+    // 再写入一条包含信号和调用栈的记录, 然后按原来的处理方式重新发送信号
+    // 日志器只在创建和销毁时登记, 写日志的路径上没有任何额外开销
+    // 文件输出建议使用FILE_FD或FILE_MMAP, FILE_STREAM缓冲在ofstream中的数据在崩溃时无法安全地写出
+    class CrashHandler
+    {
+    public:
+        // 崩溃时调用的排空函数, record是已经生成好的崩溃记录
+        using drain_t = void (*)(void *ctx, const char *record, size_t len);
+
+        // 安装信号处理函数, 重复调用只安装一次
+        static void install()
+        {
+            static std::atomic<bool> installed(false);
+            if (installed.exchange(true))
+                return;
+            // backtrace第一次调用时会加载libgcc, 提前调用, 保证信号处理函数中不会分配内存
+            void *frames[1];
+            backtrace(frames, 1);
+            memfd() = memfd_create("log_crash", MFD_CLOEXEC);
+            // 为安装线程设置备用信号栈, 栈溢出引起的SIGSEGV也能被处理
+            static char stack[64 * 1024];
+            stack_t ss;
+            ss.ss_sp = stack;
+            ss.ss_size = sizeof(stack);
+            ss.ss_flags = 0;
+            sigaltstack(&ss, nullptr);
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_sigaction = handle;
+            sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&sa.sa_mask);
+            for (int sig : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL})
+                sigaction(sig, &sa, &oldAction(sig));
+        }
+
+        // 登记和注销日志器, 由日志器在构造和析构时调用
+        static void add(drain_t drain, void *ctx)
+        {
+            for (size_t i = 0; i < CRASH_MAX_LOGGERS; ++i)
+            {
+                void *expect = nullptr;
+                if (entries()[i]._ctx.compare_exchange_strong(expect, ctx))
+                {
+                    entries()[i]._drain.store(drain, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+        static void remove(void *ctx)
+        {
+            for (size_t i = 0; i < CRASH_MAX_LOGGERS; ++i)
+            {
+                if (entries()[i]._ctx.load(std::memory_order_relaxed) == ctx)
+                {
+                    entries()[i]._drain.store(nullptr, std::memory_order_release);
+                    entries()[i]._ctx.store(nullptr, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+
+    private:
+        struct Entry
+        {
+            std::atomic<void *> _ctx;
+            std::atomic<drain_t> _drain;
+        };
+        // 全部是零初始化的静态数据, 信号处理函数中访问不会触发初始化
+        static Entry *entries()
+        {
+            static Entry entries[CRASH_MAX_LOGGERS];
+            return entries;
+        }
+        static struct sigaction &oldAction(int sig)
+        {
+            static struct sigaction actions[NSIG];
+            return actions[sig];
+        }
+        static int &memfd()
+        {
+            static int fd = -1;
+            return fd;
+        }
+
+        static void handle(int sig, siginfo_t *, void *)
+        {
+            // 处理过程中再次崩溃时直接按原来的方式处理
+            static std::atomic<bool> entered(false);
+            if (!entered.exchange(true))
+            {
+                static char record[32 * 1024];
+                size_t len = buildRecord(sig, record, sizeof(record));
+                for (size_t i = 0; i < CRASH_MAX_LOGGERS; ++i)
+                {
+                    void *ctx = entries()[i]._ctx.load(std::memory_order_acquire);
+                    drain_t drain = entries()[i]._drain.load(std::memory_order_acquire);
+                    if (ctx != nullptr && drain != nullptr)
+                        drain(ctx, record, len);
+                }
+            }
+            // 恢复原来的处理方式后重新发送信号, 信号在处理函数返回后递达
+            sigaction(sig, &oldAction(sig), nullptr);
+            raise(sig);
+        }
+
+        // 生成崩溃记录, 只使用异步信号安全的调用
+        static size_t buildRecord(int sig, char *buf, size_t cap)
+        {
+            size_t len = 0;
+            append(buf, cap, len, "caught signal ");
+            appendNum(buf, cap, len, sig, 10);
+            append(buf, cap, len, " (");
+            append(buf, cap, len, signalName(sig));
+            append(buf, cap, len, "), backtrace:\n");
+            void *frames[CRASH_MAX_FRAMES];
+            int n = backtrace(frames, CRASH_MAX_FRAMES);
+            int fd = memfd();
+            if (fd >= 0 && ftruncate(fd, 0) == 0)
+            {
+                // backtrace_symbols_fd不分配内存, 先写到内存文件中再读回, 这样所有输出都能使用
+                backtrace_symbols_fd(frames, n, fd);
+                ssize_t ret = pread(fd, buf + len, cap - len, 0);
+                if (ret > 0)
+                    return len + ret;
+            }
+            for (int i = 0; i < n; ++i)
+            {
+                append(buf, cap, len, "0x");
+                appendNum(buf, cap, len, (uintptr_t)frames[i], 16);
+                append(buf, cap, len, "\n");
+            }
+            return len;
+        }
+        static const char *signalName(int sig)
+        {
+            switch (sig)
+            {
+            case SIGSEGV:
+                return "SIGSEGV";
+            case SIGABRT:
+                return "SIGABRT";
+            case SIGBUS:
+                return "SIGBUS";
+            case SIGFPE:
+                return "SIGFPE";
+            case SIGILL:
+                return "SIGILL";
+            default:
+                return "UNKNOWN";
+            }
+        }
+        static void append(char *buf, size_t cap, size_t &len, const char *str)
+        {
+            while (*str && len < cap)
+                buf[len++] = *str++;
+        }
+        static void appendNum(char *buf, size_t cap, size_t &len, uintptr_t v, unsigned base)
+        {
+            char tmp[24];
+            size_t n = 0;
+            do
+            {
+                tmp[n++] = "0123456789abcdef"[v % base];
+                v /= base;
+            } while (v);
+            while (n > 0 && len < cap)
+                buf[len++] = tmp[--n];
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,507 @@
+#pragma once
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "logMsg.hpp"
+
+namespace Log
+{
+    // 延迟格式化的日志记录
+    // 调用线程只把原始参数、调用位置和时间戳以二进制形式拷贝到异步缓冲区中,
+    // 由异步线程完成printf格式化和Formatter格式化
+    // 记录格式: [Header][文件名][格式串/已格式化的消息][参数]
+    // 静态调用点的文件名和格式串不拷贝到记录中, 只保存调用点的地址
+    class DeferredRecord
+    {
+    public:
+        struct Header
+        {
+            uint32_t _size;        // 整条记录的长度
+            uint16_t _lv;          // 日志等级
+            uint16_t _flags;       // 记录标记
+            uint32_t _file_len;    // 记录中文件名的长度
+            uint32_t _fmt_len;     // 记录中格式串的长度, 已格式化时为消息长度
+            uint64_t _line;        // 行号
+            uint64_t _tick;        // 调用时读取的原始时钟值, 由异步线程转换为墙上时间
+            std::thread::id _tid;  // 调用线程id
+            const CallSite *_site; // 静态调用点, 为空时文件名和格式串保存在记录中
+        };
+        enum Flag
+        {
+            FORMATTED = 1,    // 消息已经在调用线程格式化完成
+            CLOCK_SHIFT = 8,  // 高8位保存时钟源
+        };
+
+        // 编码一条记录追加到out中, 格式串中存在无法延迟处理的转换时返回false, out保持不变
+        // 调用点的格式串需要以'\0'结尾
+        static bool encode(std::vector<char> &out, const CallSite &site, va_list ap)
+        {
+            int state = site._persistent ? prepare(site) : (int)CallSite::UNCACHED;
+            if (state == CallSite::UNSUPPORTED)
+                return false;
+            size_t start = out.size();
+            const char *fmt = site._fmt.data();
+            if (site._persistent)
+                putHeader(out, site, 0, 0);
+            else
+            {
+                // 临时的调用点不能被引用, 格式串保留结尾的'\0'拷贝到记录中, 解码时可以直接使用
+                putHeader(out, site, site._fmt.size(), 0);
+                out.insert(out.end(), fmt, fmt + site._fmt.size() + 1);
+            }
+            va_list args;
+            va_copy(args, ap);
+            bool ok = true;
+            if (state == CallSite::PARSED)
+            {
+                // 使用预解析的转换说明, 不需要再扫描格式串
+                for (size_t i = 0; i < site._nconvs; ++i)
+                {
+                    const CallSite::Conv &conv = site._convs[i];
+                    int prec = putStars(out, conv._stars, conv._prec, &args);
+                    encodeArg(out, conv._conv, conv._mod, prec, &args);
+                }
+            }
+            else
+            {
+                for (const char *p = fmt; *p; ++p)
+                {
+                    if (*p != '%')
+                        continue;
+                    Spec spec;
+                    if (!parseSpec(p, spec))
+                    {
+                        ok = false;
+                        break;
+                    }
+                    p = spec._end - 1;
+                    if (spec._conv == '%')
+                        continue;
+                    int prec = putStars(out, spec._stars, spec._prec, &args);
+                    encodeArg(out, spec._conv, spec._mod, prec, &args);
+                }
+            }
+            va_end(args);
+            if (!ok)
+            {
+                out.resize(start);
+                return false;
+            }
+            finish(out, start);
+            return true;
+        }
+
+        // 编码一条已经格式化完成的记录, 用于无法延迟处理的格式串
+        static void encodeFormatted(std::vector<char> &out, const CallSite &site, const char *payload, size_t len)
+        {
+            size_t start = out.size();
+            putHeader(out, site, len, FORMATTED);
+            out.insert(out.end(), payload, payload + len);
+            finish(out, start);
+        }
+
+        // 从data中解码一条记录, 返回记录长度, 数据不完整时返回0
+        // msg中的视图指向data或payload, payload用来保存格式化后的消息
+        static size_t decode(const char *data, size_t len, LogMessage &msg, std::string &payload)
+        {
+            Header hdr;
+            if (len < sizeof(hdr))
+                return 0;
+            memcpy(&hdr, data, sizeof(hdr));
+            if (hdr._size > len)
+                return 0;
+            const char *p = data + sizeof(hdr);
+            msg._file = hdr._site ? hdr._site->_file : StringView(p, hdr._file_len);
+            p += hdr._file_len;
+            if (hdr._flags & FORMATTED)
+                msg._payload = StringView(p, hdr._fmt_len);
+            else
+            {
+                payload.clear();
+                if (hdr._site)
+                    format(payload, hdr._site->_fmt.data(), p);
+                else
+                    format(payload, p, p + hdr._fmt_len + 1);
+                msg._payload = payload;
+            }
+            msg._lv = (LogLevel::Level)hdr._lv;
+            msg._line = hdr._line;
+            Util::Clock::toWall((Util::ClockSource)(hdr._flags >> CLOCK_SHIFT), hdr._tick, msg._ctime, msg._nsec);
+            msg._tid = hdr._tid;
+            return hdr._size;
+        }
+
+    private:
+        // 一个printf转换说明, 例如 %-8.*lld
+        struct Spec
+        {
+            const char *_begin;
+            const char *_end; // 转换说明结束位置的下一个字符
+            char _conv;       // 转换字符
+            char _mod;        // 长度修饰: 0, 'H'(hh), 'h', 'l', 'q'(ll), 'L', 'j', 'z', 't'
+            int _stars;       // 宽度和精度中'*'的个数
+            int _prec;        // 精度, PREC_NONE表示没有指定, PREC_STAR表示由参数给出
+        };
+        enum
+        {
+            PREC_NONE = -1,
+            PREC_STAR = -2,
+        };
+
+        // 解析从p('%')开始的转换说明, 不支持的转换(%n, %m, 位置参数, 宽字符)返回false
+        static bool parseSpec(const char *p, Spec &spec)
+        {
+            spec._begin = p++;
+            spec._mod = 0;
+            spec._stars = 0;
+            spec._prec = PREC_NONE;
+            if (*p == '%')
+            {
+                spec._conv = '%';
+                spec._end = p + 1;
+                return true;
+            }
+            while (*p && strchr("-+ #0'I", *p))
+                ++p;
+            if (*p == '*')
+                ++spec._stars, ++p;
+            while (*p >= '0' && *p <= '9')
+                ++p;
+            if (*p == '$')
+                return false;
+            if (*p == '.')
+            {
+                ++p;
+                if (*p == '*')
+                    ++spec._stars, ++p, spec._prec = PREC_STAR;
+                else
+                    spec._prec = 0;
+                while (*p >= '0' && *p <= '9')
+                {
+                    if (spec._prec < 100000000)
+                        spec._prec = spec._prec * 10 + (*p - '0');
+                    ++p;
+                }
+            }
+            switch (*p)
+            {
+            case 'h':
+                spec._mod = (p[1] == 'h') ? (++p, 'H') : 'h';
+                ++p;
+                break;
+            case 'l':
+                spec._mod = (p[1] == 'l') ? (++p, 'q') : 'l';
+                ++p;
+                break;
+            case 'q':
+            case 'L':
+            case 'j':
+            case 'z':
+            case 't':
+                spec._mod = (*p == 'q') ? 'q' : *p;
+                ++p;
+                break;
+            case 'Z':
+                spec._mod = 'z';
+                ++p;
+                break;
+            }
+            if (*p == '\0' || !strchr("diouxXcseEfFgGaAp", *p))
+                return false;
+            if (spec._mod == 'l' && (*p == 'c' || *p == 's'))
+                return false; // 宽字符
+            spec._conv = *p;
+            spec._end = p + 1;
+            return spec._end - spec._begin < 64;
+        }
+
+        // 第一次使用静态调用点时解析格式串并缓存转换说明, 返回调用点的状态
+        static int prepare(const CallSite &site)
+        {
+            int state = site._state.load(std::memory_order_acquire);
+            if (state != CallSite::UNPARSED)
+                return state;
+            if (!site._state.compare_exchange_strong(state, CallSite::PARSING, std::memory_order_acquire))
+                return state; // 其他线程正在解析, 这次调用自己解析
+            int result = CallSite::PARSED;
+            size_t n = 0;
+            for (const char *p = site._fmt.data(); *p; ++p)
+            {
+                if (*p != '%')
+                    continue;
+                Spec spec;
+                if (!parseSpec(p, spec))
+                {
+                    result = CallSite::UNSUPPORTED;
+                    break;
+                }
+                p = spec._end - 1;
+                if (spec._conv == '%')
+                    continue;
+                if (n == CallSite::MAX_CONVS)
+                {
+                    result = CallSite::UNCACHED; // 继续扫描, 检查后面是否有无法延迟处理的转换
+                    continue;
+                }
+                CallSite::Conv &conv = site._convs[n++];
+                conv._conv = spec._conv;
+                conv._mod = spec._mod;
+                conv._stars = spec._stars;
+                conv._prec = spec._prec;
+            }
+            site._nconvs = n;
+            site._state.store(result, std::memory_order_release);
+            return result;
+        }
+
+        // 编码'*'给出的宽度和精度, 返回转换实际使用的精度, 负数表示没有精度
+        static int putStars(std::vector<char> &out, int stars, int prec, va_list *args)
+        {
+            int value = 0;
+            for (int i = 0; i < stars; ++i)
+            {
+                value = va_arg(*args, int);
+                put<int>(out, value);
+            }
+            // 精度的'*'总是最后一个
+            return prec == PREC_STAR ? value : prec;
+        }
+
+        static void encodeArg(std::vector<char> &out, char conv, char mod, int prec, va_list *args)
+        {
+            switch (conv)
+            {
+            case 'd':
+            case 'i':
+                switch (mod)
+                {
+                case 'l':
+                    return put<int64_t>(out, va_arg(*args, long));
+                case 'q':
+                    return put<int64_t>(out, va_arg(*args, long long));
+                case 'j':
+                    return put<int64_t>(out, va_arg(*args, intmax_t));
+                case 'z':
+                    return put<int64_t>(out, va_arg(*args, ssize_t));
+                case 't':
+                    return put<int64_t>(out, va_arg(*args, ptrdiff_t));
+                default:
+                    return put<int64_t>(out, va_arg(*args, int));
+                }
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                switch (mod)
+                {
+                case 'l':
+                    return put<uint64_t>(out, va_arg(*args, unsigned long));
+                case 'q':
+                    return put<uint64_t>(out, va_arg(*args, unsigned long long));
+                case 'j':
+                    return put<uint64_t>(out, va_arg(*args, uintmax_t));
+                case 'z':
+                    return put<uint64_t>(out, va_arg(*args, size_t));
+                case 't':
+                    return put<uint64_t>(out, va_arg(*args, ptrdiff_t));
+                default:
+                    return put<uint64_t>(out, va_arg(*args, unsigned int));
+                }
+            case 'c':
+                return put<int64_t>(out, va_arg(*args, int));
+            case 'p':
+                return put<uint64_t>(out, (uint64_t)(uintptr_t)va_arg(*args, void *));
+            case 's':
+            {
+                // 字符串需要拷贝内容, 调用返回后指针可能失效
+                // 指定了精度时字符串可以不以'\0'结尾, 只读取精度以内的部分, 结尾的'\0'由这里补上
+                const char *str = va_arg(*args, const char *);
+                uint32_t len = UINT32_MAX;
+                if (str)
+                    len = (uint32_t)(prec < 0 ? strlen(str) : strnlen(str, prec));
+                put<uint32_t>(out, len);
+                if (str)
+                {
+                    out.insert(out.end(), str, str + len);
+                    out.push_back('\0');
+                }
+                return;
+            }
+            default:
+                if (mod == 'L')
+                    return put<long double>(out, va_arg(*args, long double));
+                return put<double>(out, va_arg(*args, double));
+            }
+        }
+
+        // 在异步线程中按照格式串和参数还原出消息
+        static void format(std::string &out, const char *fmt, const char *args)
+        {
+            for (const char *p = fmt; *p;)
+            {
+                if (*p != '%')
+                {
+                    const char *next = strchr(p, '%');
+                    if (next == nullptr)
+                        next = p + strlen(p);
+                    out.append(p, next);
+                    p = next;
+                    continue;
+                }
+                Spec spec;
+                parseSpec(p, spec);
+                p = spec._end;
+                if (spec._conv == '%')
+                {
+                    out += '%';
+                    continue;
+                }
+                char conv[64];
+                memcpy(conv, spec._begin, spec._end - spec._begin);
+                conv[spec._end - spec._begin] = '\0';
+                int stars[2] = {0, 0};
+                for (int i = 0; i < spec._stars; ++i)
+                    stars[i] = get<int>(args);
+                decodeArg(out, spec, conv, stars, args);
+            }
+        }
+
+        static void decodeArg(std::string &out, const Spec &spec, const char *conv, const int *stars, const char *&args)
+        {
+            switch (spec._conv)
+            {
+            case 'd':
+            case 'i':
+            {
+                int64_t v = get<int64_t>(args);
+                switch (spec._mod)
+                {
+                case 'l':
+                    return emit(out, conv, stars, spec._stars, (long)v);
+                case 'q':
+                    return emit(out, conv, stars, spec._stars, (long long)v);
+                case 'j':
+                    return emit(out, conv, stars, spec._stars, (intmax_t)v);
+                case 'z':
+                    return emit(out, conv, stars, spec._stars, (ssize_t)v);
+                case 't':
+                    return emit(out, conv, stars, spec._stars, (ptrdiff_t)v);
+                default:
+                    return emit(out, conv, stars, spec._stars, (int)v);
+                }
+            }
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t v = get<uint64_t>(args);
+                switch (spec._mod)
+                {
+                case 'l':
+                    return emit(out, conv, stars, spec._stars, (unsigned long)v);
+                case 'q':
+                    return emit(out, conv, stars, spec._stars, (unsigned long long)v);
+                case 'j':
+                    return emit(out, conv, stars, spec._stars, (uintmax_t)v);
+                case 'z':
+                    return emit(out, conv, stars, spec._stars, (size_t)v);
+                case 't':
+                    return emit(out, conv, stars, spec._stars, (ptrdiff_t)v);
+                default:
+                    return emit(out, conv, stars, spec._stars, (unsigned int)v);
+                }
+            }
+            case 'c':
+                return emit(out, conv, stars, spec._stars, (int)get<int64_t>(args));
+            case 'p':
+                return emit(out, conv, stars, spec._stars, (void *)(uintptr_t)get<uint64_t>(args));
+            case 's':
+            {
+                uint32_t len = get<uint32_t>(args);
+                const char *str = nullptr;
+                if (len != UINT32_MAX)
+                {
+                    str = args;
+                    args += len + 1;
+                }
+                return emit(out, conv, stars, spec._stars, str);
+            }
+            default:
+                if (spec._mod == 'L')
+                    return emit(out, conv, stars, spec._stars, get<long double>(args));
+                return emit(out, conv, stars, spec._stars, get<double>(args));
+            }
+        }
+
+        // 使用单个转换说明格式化一个参数, 直接写入out的尾部
+        template <typename T>
+        static void emit(std::string &out, const char *conv, const int *stars, int nstars, T v)
+        {
+            size_t old = out.size();
+            size_t room = 64;
+            while (true)
+            {
+                out.resize(old + room + 1);
+                int n;
+                if (nstars == 0)
+                    n = snprintf(&out[old], room + 1, conv, v);
+                else if (nstars == 1)
+                    n = snprintf(&out[old], room + 1, conv, stars[0], v);
+                else
+                    n = snprintf(&out[old], room + 1, conv, stars[0], stars[1], v);
+                if (n < 0)
+                    n = 0;
+                if ((size_t)n <= room)
+                {
+                    out.resize(old + n);
+                    return;
+                }
+                room = n;
+            }
+        }
+
+        static void putHeader(std::vector<char> &out, const CallSite &site, size_t fmt_len, uint16_t flags)
+        {
+            Header hdr;
+            hdr._size = 0;
+            hdr._lv = site._lv;
+            Util::ClockSource src = Util::Clock::getSource();
+            hdr._flags = flags | (uint16_t)(src << CLOCK_SHIFT);
+            hdr._file_len = site._persistent ? 0 : site._file.size();
+            hdr._fmt_len = fmt_len;
+            hdr._line = site._line;
+            hdr._tick = Util::Clock::tick(src);
+            hdr._tid = std::this_thread::get_id();
+            hdr._site = site._persistent ? &site : nullptr;
+            put(out, hdr);
+            if (!site._persistent)
+                out.insert(out.end(), site._file.data(), site._file.data() + site._file.size());
+        }
+        // 填写记录的总长度
+        static void finish(std::vector<char> &out, size_t start)
+        {
+            uint32_t size = out.size() - start;
+            memcpy(&out[start] + offsetof(Header, _size), &size, sizeof(size));
+        }
+
+        template <typename T>
+        static void put(std::vector<char> &out, const T &v)
+        {
+            const char *p = reinterpret_cast<const char *>(&v);
+            out.insert(out.end(), p, p + sizeof(T));
+        }
+        template <typename T>
+        static T get(const char *&args)
+        {
+            T v;
+            memcpy(&v, args, sizeof(T));
+            args += sizeof(T);
+            return v;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,213 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Log
+{
+// 共享执行器默认的工作线程数量
+#define EXECUTOR_DEFAULT_THREADS 2
+
+    // 可以交给共享执行器调度的任务
+    class ExecutorTask
+    {
+    public:
+        virtual ~ExecutorTask() {}
+        // 处理一批数据, 返回true表示还有数据, 执行器会把任务放回就绪队列末尾
+        // 返回false时任务已经处于空闲状态, 有新数据时由任务自己重新调度
+        virtual bool runOnce() = 0;
+        // 定时唤醒的间隔(毫秒), 0表示不需要定时唤醒
+        virtual size_t tickInterval() = 0;
+        // 到达定时唤醒间隔时由执行器调用
+        virtual void tick() = 0;
+    };
+
+    // 多个异步日志器共享的后端执行器, 由固定数量的工作线程处理所有登记的任务
+    // 同一个任务同一时刻只在一个工作线程中执行, 单个日志器的输出顺序不变
+    // 任务每次只处理一批数据就放回队列末尾, 繁忙的日志器不会饿死其他日志器
+    class AsyncExecutor
+    {
+    public:
+        using ptr = std::shared_ptr<AsyncExecutor>;
+        // cpus不为空时第i个工作线程绑定到cpus[i % cpus.size()]上
+        AsyncExecutor(size_t threads = EXECUTOR_DEFAULT_THREADS, const std::vector<int> &cpus = std::vector<int>())
+            : _stop(false), _next_tick(0)
+        {
+            if (threads == 0)
+                threads = 1;
+            for (size_t i = 0; i < threads; ++i)
+            {
+                _workers.emplace_back(&AsyncExecutor::workerEntry, this);
+                std::string name = "log-exec-" + std::to_string(i);
+                pthread_setname_np(_workers.back().native_handle(), name.c_str());
+                if (!cpus.empty())
+                    bind(_workers.back(), cpus[i % cpus.size()]);
+            }
+        }
+        // 日志器持有执行器的引用, 执行器析构时所有任务都已经注销
+        ~AsyncExecutor()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            for (auto &worker : _workers)
+                worker.join();
+        }
+
+        // 登记和注销任务, 注销返回后执行器不会再定时唤醒该任务
+        void add(ExecutorTask *task)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_timer_mutex);
+                _tasks.push_back(Timer{task, 0, 0});
+            }
+            retime();
+        }
+        void remove(ExecutorTask *task)
+        {
+            std::unique_lock<std::mutex> lock(_timer_mutex);
+            for (auto it = _tasks.begin(); it != _tasks.end(); ++it)
+            {
+                if (it->_task == task)
+                {
+                    _tasks.erase(it);
+                    return;
+                }
+            }
+        }
+        // 任务有数据需要处理时调用, 任务保证自己在队列中最多出现一次
+        void schedule(ExecutorTask *task)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.push_back(task);
+            _cond.notify_one();
+        }
+        // 任务的唤醒间隔改变后调用, 立即重新计算定时
+        void retime()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _next_tick = nowMs();
+            _cond.notify_one();
+        }
+
+        size_t threads()
+        {
+            return _workers.size();
+        }
+
+    private:
+        struct Timer
+        {
+            ExecutorTask *_task;
+            size_t _interval; // 计算截止时间时使用的间隔
+            size_t _deadline; // 下一次唤醒的时间
+        };
+
+        void workerEntry()
+        {
+            while (true)
+            {
+                ExecutorTask *task = nullptr;
+                bool timer = false;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    while (!_stop && _ready.empty() && !due())
+                    {
+                        size_t now = nowMs();
+                        if (_next_tick == 0)
+                            _cond.wait(lock);
+                        else if (_next_tick > now)
+                            _cond.wait_for(lock, std::chrono::milliseconds(_next_tick - now));
+                    }
+                    if (_stop && _ready.empty())
+                        break;
+                    // 队列一直繁忙时也要检查定时, 由取到定时的线程负责唤醒任务
+                    if (due())
+                    {
+                        timer = true;
+                        _next_tick = 0;
+                    }
+                    if (!_ready.empty())
+                    {
+                        task = _ready.front();
+                        _ready.pop_front();
+                    }
+                }
+                if (timer)
+                    fireTimers();
+                if (task != nullptr && task->runOnce())
+                    schedule(task);
+            }
+        }
+
+        bool due()
+        {
+            return _next_tick != 0 && nowMs() >= _next_tick;
+        }
+        // 唤醒到期的任务并计算下一次定时, 锁的顺序: _timer_mutex -> 任务的锁 -> _mutex
+        void fireTimers()
+        {
+            size_t now = nowMs();
+            size_t next = 0;
+            {
+                std::unique_lock<std::mutex> lock(_timer_mutex);
+                for (auto &timer : _tasks)
+                {
+                    size_t interval = timer._task->tickInterval();
+                    if (interval == 0)
+                        continue;
+                    if (interval != timer._interval)
+                    {
+                        timer._interval = interval;
+                        timer._deadline = now + interval;
+                    }
+                    if (now >= timer._deadline)
+                    {
+                        timer._task->tick();
+                        timer._deadline = now + interval;
+                    }
+                    next = next == 0 ? timer._deadline : std::min(next, timer._deadline);
+                }
+            }
+            if (next == 0)
+                return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _next_tick = _next_tick == 0 ? next : std::min(_next_tick, next);
+            _cond.notify_one();
+        }
+
+        static void bind(std::thread &worker, int cpu)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+        }
+        static size_t nowMs()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        bool _stop;
+        std::mutex _mutex;                 // 保护就绪队列和定时
+        std::condition_variable _cond;     // 工作线程等待任务
+        std::deque<ExecutorTask *> _ready; // 就绪队列, 按先进先出轮流处理
+        size_t _next_tick;                 // 最近的定时唤醒时间, 0表示没有
+        std::mutex _timer_mutex;           // 保护_tasks
+        std::vector<Timer> _tasks;         // 登记的所有任务
+        std::vector<std::thread> _workers; // 工作线程
+    };
+}
\ No newline at end of file
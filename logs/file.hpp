@@ -0,0 +1,323 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "util.hpp"
+
+namespace Log
+{
+// 内存映射文件每次映射的窗口大小
+#define MMAP_WINDOW_SIZE (1024 * 1024 * 8)
+    // 日志文件的写入方式
+    enum FileBackend
+    {
+        FILE_STREAM, // std::ofstream
+        FILE_FD,     // 以O_APPEND打开的文件描述符, 通过write/writev写入
+        FILE_MMAP,   // 拷贝到映射的窗口中, 不需要系统调用, 进程崩溃时数据已经在页缓存中
+    };
+
+    // 输出使用的日志文件, 屏蔽不同的写入方式, 文件在析构时关闭
+    class LogFile
+    {
+    public:
+        using ptr = std::shared_ptr<LogFile>;
+        virtual ~LogFile() {}
+        virtual bool write(const char *data, size_t len) = 0;
+        // 将内部缓冲的数据交给操作系统
+        virtual void flush() {}
+        // 将已写入的数据同步到磁盘
+        virtual bool sync() = 0;
+        virtual bool writev(const struct iovec *iov, size_t cnt)
+        {
+            bool ok = true;
+            for (size_t i = 0; i < cnt; ++i)
+                ok = write(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len) && ok;
+            return ok;
+        }
+        // 进程崩溃时由信号处理函数调用, 默认的写入方式已经是异步信号安全的
+        virtual bool crashWrite(const char *data, size_t len)
+        {
+            return write(data, len);
+        }
+
+        // 写入所有数据段, 被信号中断或只写入了一部分时继续写剩余的部分, 出错时返回false
+        static bool writeAll(int fd, const struct iovec *iov, size_t cnt)
+        {
+            static const size_t BATCH = 64; // 单次writev的段数, 远小于IOV_MAX
+            struct iovec batch[BATCH];
+            size_t idx = 0; // 当前段
+            size_t off = 0; // 当前段中已写入的字节数
+            while (idx < cnt)
+            {
+                size_t n = 0;
+                for (size_t i = idx; i < cnt && n < BATCH; ++i)
+                    batch[n++] = iov[i];
+                batch[0].iov_base = static_cast<char *>(batch[0].iov_base) + off;
+                batch[0].iov_len -= off;
+                ssize_t ret = ::writev(fd, batch, (int)n);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                // 跳过已经完整写入的段
+                size_t written = (size_t)ret;
+                while (idx < cnt && written >= iov[idx].iov_len - off)
+                {
+                    written -= iov[idx].iov_len - off;
+                    off = 0;
+                    ++idx;
+                }
+                off += written;
+            }
+            return true;
+        }
+        static bool writeAll(int fd, const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t ret = ::write(fd, data, len);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    return false;
+                data += ret;
+                len -= ret;
+            }
+            return true;
+        }
+    };
+
+    class StreamFile : public LogFile
+    {
+    public:
+        StreamFile(const std::string &pathname)
+        {
+            _ofs.open(pathname, std::ios::app | std::ios::binary);
+            assert(_ofs.is_open());
+            // ofstream不提供文件描述符, 另外打开一个描述符用于同步和崩溃时的写入
+            _fd = open(pathname.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            assert(_fd >= 0);
+        }
+        ~StreamFile()
+        {
+            close(_fd);
+        }
+        bool write(const char *data, size_t len)
+        {
+            _ofs.write(data, len);
+            return _ofs.good();
+        }
+        void flush()
+        {
+            _ofs.flush();
+        }
+        // 刷新缓冲后通过另外打开的描述符同步同一个文件
+        bool sync()
+        {
+            _ofs.flush();
+            return fdatasync(_fd) == 0 && _ofs.good();
+        }
+        // 只通过另外打开的描述符追加, 刷新ofstream不是异步信号安全的
+        // ofstream中还没有交给系统的数据在崩溃时会丢失, 使用崩溃处理时应当选择FILE_FD或FILE_MMAP
+        bool crashWrite(const char *data, size_t len)
+        {
+            return writeAll(_fd, data, len);
+        }
+
+    private:
+        std::ofstream _ofs;
+        int _fd; // 用于同步和崩溃写入的描述符
+    };
+
+    // 直接通过文件描述符追加写入, 没有ofstream的二次缓冲, 多个数据段通过writev一次写入
+    // prealloc_size不为0时按该粒度用fallocate预分配磁盘空间(不改变文件大小), 减少追加时的块分配
+    class FdFile : public LogFile
+    {
+    public:
+        FdFile(const std::string &pathname, size_t prealloc_size = 0)
+            : _prealloc_size(prealloc_size), _size(0), _allocated(0)
+        {
+            _fd = open(pathname.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            assert(_fd >= 0);
+            struct stat st;
+            if (fstat(_fd, &st) == 0)
+                _size = _allocated = st.st_size;
+        }
+        ~FdFile()
+        {
+            close(_fd);
+        }
+        bool write(const char *data, size_t len)
+        {
+            struct iovec iov;
+            iov.iov_base = const_cast<char *>(data);
+            iov.iov_len = len;
+            return writev(&iov, 1);
+        }
+        bool writev(const struct iovec *iov, size_t cnt)
+        {
+            if (_prealloc_size != 0)
+            {
+                size_t total = 0;
+                for (size_t i = 0; i < cnt; ++i)
+                    total += iov[i].iov_len;
+                preallocate(total);
+                _size += total;
+            }
+            return writeAll(_fd, iov, cnt);
+        }
+        bool sync()
+        {
+            return fdatasync(_fd) == 0;
+        }
+
+    private:
+        void preallocate(size_t len)
+        {
+            if (_size + len <= _allocated)
+                return;
+            size_t target = (_size + len) / _prealloc_size * _prealloc_size + _prealloc_size;
+            if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, _allocated, target - _allocated) != 0)
+                _prealloc_size = 0; // 文件系统不支持时不再预分配
+            else
+                _allocated = target;
+        }
+
+    private:
+        int _fd;
+        size_t _prealloc_size; // 预分配的粒度, 0表示不预分配
+        size_t _size;          // 当前文件大小
+        size_t _allocated;     // 已经预分配到的位置
+    };
+
+    // 将文件的一段窗口映射到内存中, 写入只是内存拷贝, 窗口写满时才需要系统调用
+    // 文件按窗口预先扩展, 正常关闭时截断到实际大小; 进程崩溃时文件末尾会留下全零的区域, 再次打开时去掉
+    class MmapFile : public LogFile
+    {
+    public:
+        MmapFile(const std::string &pathname)
+            : _base(nullptr), _window(0), _size(0)
+        {
+            _fd = open(pathname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            assert(_fd >= 0);
+            _size = recoverSize();
+            _window = _size / MMAP_WINDOW_SIZE * MMAP_WINDOW_SIZE;
+            map();
+        }
+        ~MmapFile()
+        {
+            if (_base != nullptr)
+                munmap(_base, MMAP_WINDOW_SIZE);
+            // 去掉预先扩展但没有写入的部分
+            if (ftruncate(_fd, _size) != 0)
+                std::cout << "截断映射文件失败: " << strerror(errno) << std::endl;
+            close(_fd);
+        }
+        bool write(const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                if (_base == nullptr)
+                    return false;
+                size_t pos = _size - _window;
+                if (pos == MMAP_WINDOW_SIZE)
+                {
+                    // 当前窗口已写满, 滑动到下一个窗口
+                    munmap(_base, MMAP_WINDOW_SIZE);
+                    _window += MMAP_WINDOW_SIZE;
+                    map();
+                    continue;
+                }
+                size_t n = std::min(len, (size_t)MMAP_WINDOW_SIZE - pos);
+                memcpy(_base + pos, data, n);
+                _size += n;
+                data += n;
+                len -= n;
+            }
+            return true;
+        }
+        // 写入只修改了映射的页面, 先写回当前窗口, 之前的窗口已经解除映射, 由fdatasync写回
+        bool sync()
+        {
+            if (_base != nullptr && msync(_base, _size - _window, MS_SYNC) != 0)
+                return false;
+            return fdatasync(_fd) == 0;
+        }
+
+    private:
+        // 扩展文件并映射当前窗口, 优先用fallocate分配磁盘空间, 避免磁盘已满时访问映射触发SIGBUS
+        void map()
+        {
+            _base = nullptr;
+            off_t end = _window + MMAP_WINDOW_SIZE;
+            if (fallocate(_fd, 0, _window, MMAP_WINDOW_SIZE) != 0 && ftruncate(_fd, end) != 0)
+            {
+                std::cout << "扩展映射文件失败: " << strerror(errno) << std::endl;
+                return;
+            }
+            void *p = mmap(nullptr, MMAP_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, _window);
+            if (p == MAP_FAILED)
+            {
+                std::cout << "映射文件失败: " << strerror(errno) << std::endl;
+                return;
+            }
+            _base = static_cast<char *>(p);
+        }
+        // 已有文件的实际大小, 跳过上次崩溃时留在末尾的全零区域(最多一个窗口)
+        size_t recoverSize()
+        {
+            struct stat st;
+            if (fstat(_fd, &st) != 0 || st.st_size == 0)
+                return 0;
+            size_t size = st.st_size;
+            size_t limit = size > MMAP_WINDOW_SIZE ? size - MMAP_WINDOW_SIZE : 0;
+            char buf[4096];
+            while (size > limit)
+            {
+                size_t n = std::min(sizeof(buf), size - limit);
+                if (pread(_fd, buf, n, size - n) != (ssize_t)n)
+                    break;
+                size_t i = n;
+                while (i > 0 && buf[i - 1] == '\0')
+                    --i;
+                if (i > 0)
+                    return size - n + i;
+                size -= n;
+            }
+            return size;
+        }
+
+    private:
+        int _fd;
+        char *_base;    // 当前窗口映射的地址
+        size_t _window; // 当前窗口在文件中的偏移
+        size_t _size;   // 已写入的数据大小
+    };
+
+    class LogFileFactory
+    {
+    public:
+        // prealloc_size只对FILE_FD有效
+        static LogFile::ptr create(const std::string &pathname, FileBackend backend, size_t prealloc_size = 0)
+        {
+            switch (backend)
+            {
+            case FileBackend::FILE_FD:
+                return std::make_shared<FdFile>(pathname, prealloc_size);
+            case FileBackend::FILE_MMAP:
+                return std::make_shared<MmapFile>(pathname);
+            default:
+                return std::make_shared<StreamFile>(pathname);
+            }
+        }
+    };
+}
\ No newline at end of file
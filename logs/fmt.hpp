@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace Log
+{
+    // 类型安全的格式化: 格式串中使用{}作为占位符, {{和}}分别输出{和}
+    // 参数类型由模板推导, 不支持的类型在编译期报错, 格式化结果写入栈上的缓冲区
+    namespace Fmt
+    {
+        // 写入调用者提供的缓冲区, 空间不足时转移到线程局部的缓冲区中(只在第一次增长时分配内存)
+        class Writer
+        {
+        public:
+            Writer(char *buf, size_t cap)
+                : _buf(buf), _cap(cap), _len(0) {}
+
+            void append(const char *data, size_t len)
+            {
+                if (_len + len > _cap)
+                    grow(_len + len);
+                memcpy(_buf + _len, data, len);
+                _len += len;
+            }
+            void append(char c)
+            {
+                if (_len + 1 > _cap)
+                    grow(_len + 1);
+                _buf[_len++] = c;
+            }
+            // 以'\0'结尾的结果
+            const char *c_str()
+            {
+                append('\0');
+                --_len;
+                return _buf;
+            }
+            const char *data() const
+            {
+                return _buf;
+            }
+            size_t size() const
+            {
+                return _len;
+            }
+
+        private:
+            void grow(size_t need)
+            {
+                static thread_local std::string overflow;
+                size_t cap = std::max(need, _cap * 2);
+                bool in_overflow = !overflow.empty() && _buf == &overflow[0];
+                if (overflow.size() < cap)
+                    overflow.resize(cap); // resize会保留已有内容
+                if (!in_overflow)
+                    memcpy(&overflow[0], _buf, _len);
+                _buf = &overflow[0];
+                _cap = overflow.size();
+            }
+
+        private:
+            char *_buf;
+            size_t _cap;
+            size_t _len;
+        };
+
+        // 各种类型参数的输出
+        inline void writeArg(Writer &w, const char *str)
+        {
+            if (str == nullptr)
+                str = "(null)";
+            w.append(str, strlen(str));
+        }
+        inline void writeArg(Writer &w, const std::string &str)
+        {
+            w.append(str.data(), str.size());
+        }
+        inline void writeArg(Writer &w, bool v)
+        {
+            if (v)
+                w.append("true", 4);
+            else
+                w.append("false", 5);
+        }
+        inline void writeArg(Writer &w, char c)
+        {
+            w.append(c);
+        }
+        inline void writeUInt(Writer &w, uint64_t v)
+        {
+            char tmp[24];
+            char *p = tmp + sizeof(tmp);
+            do
+            {
+                *--p = '0' + v % 10;
+                v /= 10;
+            } while (v);
+            w.append(p, tmp + sizeof(tmp) - p);
+        }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        writeArg(Writer &w, T v)
+        {
+            if (v < 0)
+            {
+                w.append('-');
+                writeUInt(w, (uint64_t)0 - (uint64_t)(int64_t)v);
+                return;
+            }
+            writeUInt(w, (uint64_t)v);
+        }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        writeArg(Writer &w, T v)
+        {
+            writeUInt(w, (uint64_t)v);
+        }
+        template <typename T>
+        typename std::enable_if<std::is_enum<T>::value>::type
+        writeArg(Writer &w, T v)
+        {
+            writeArg(w, (typename std::underlying_type<T>::type)v);
+        }
+        // 浮点数与流输出的默认格式保持一致(6位有效数字)
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        writeArg(Writer &w, T v)
+        {
+            char tmp[64];
+            int n = snprintf(tmp, sizeof(tmp), "%Lg", (long double)v);
+            w.append(tmp, n);
+        }
+        template <typename T>
+        void writeArg(Writer &w, const T *p)
+        {
+            char tmp[32];
+            int n = snprintf(tmp, sizeof(tmp), "%p", (const void *)p);
+            w.append(tmp, n);
+        }
+
+        // 输出fmt中第一个占位符之前的内容, 返回占位符之后的位置, 没有占位符时返回nullptr
+        inline const char *writeUntilPlaceholder(Writer &w, const char *fmt)
+        {
+            const char *p = fmt;
+            while (*p)
+            {
+                if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}'))
+                {
+                    w.append(fmt, p - fmt + 1);
+                    p += 2;
+                    fmt = p;
+                    continue;
+                }
+                if (p[0] == '{' && p[1] == '}')
+                {
+                    w.append(fmt, p - fmt);
+                    return p + 2;
+                }
+                ++p;
+            }
+            w.append(fmt, p - fmt);
+            return nullptr;
+        }
+
+        inline void format(Writer &w, const char *fmt)
+        {
+            // 参数不足时剩余的占位符原样输出
+            while (fmt != nullptr)
+            {
+                fmt = writeUntilPlaceholder(w, fmt);
+                if (fmt != nullptr)
+                    w.append("{}", 2);
+            }
+        }
+        template <typename T, typename... Args>
+        void format(Writer &w, const char *fmt, const T &v, const Args &...args)
+        {
+            fmt = writeUntilPlaceholder(w, fmt);
+            if (fmt == nullptr)
+                return; // 多余的参数被忽略
+            writeArg(w, v);
+            format(w, fmt, args...);
+        }
+
+        // 编译期计算格式串中占位符的个数, 括号不匹配时返回BAD_FORMAT
+        // C++11的constexpr函数只能递归, 逐字符递归时长格式串会超过编译器的递归深度限制,
+        // 所以按二分递归, 深度与格式串长度的对数成正比, 只有连续几百个括号的格式串仍会超过限制
+        static const size_t BAD_FORMAT = (size_t)-1;
+        constexpr size_t addCount(size_t a, size_t b)
+        {
+            return a == BAD_FORMAT || b == BAD_FORMAT ? BAD_FORMAT : a + b;
+        }
+        // 逐字符计算[b, e)中的占位符, 只用于很短的区间
+        constexpr size_t countLinear(const char *s, size_t b, size_t e, size_t n)
+        {
+            return b >= e ? n
+                   : b + 1 < e && ((s[b] == '{' && s[b + 1] == '{') || (s[b] == '}' && s[b + 1] == '}')) ? countLinear(s, b + 2, e, n)
+                   : b + 1 < e && s[b] == '{' && s[b + 1] == '}'                                         ? countLinear(s, b + 2, e, n + 1)
+                   : (s[b] == '{' || s[b] == '}')                                                        ? BAD_FORMAT
+                                                                                                         : countLinear(s, b + 1, e, n);
+        }
+        // 从m开始找第一个紧跟在普通字符之后的位置, 普通字符总是单独成为一个记号, 在这里切分不会拆开"{}"、"{{"和"}}"
+        constexpr size_t splitPoint(const char *s, size_t m, size_t e)
+        {
+            return m >= e || (s[m - 1] != '{' && s[m - 1] != '}') ? m : splitPoint(s, m + 1, e);
+        }
+        constexpr size_t countRange(const char *s, size_t b, size_t e);
+        constexpr size_t countSplit(const char *s, size_t b, size_t m, size_t e)
+        {
+            // 后半段全是括号时无法切分, 退回逐字符计算
+            return m >= e ? countLinear(s, b, e, 0) : addCount(countRange(s, b, m), countRange(s, m, e));
+        }
+        constexpr size_t countRange(const char *s, size_t b, size_t e)
+        {
+            return e - b <= 32 ? countLinear(s, b, e, 0) : countSplit(s, b, splitPoint(s, b + (e - b) / 2, e), e);
+        }
+        template <size_t N>
+        constexpr size_t placeholders(const char (&s)[N])
+        {
+            return countRange(s, 0, N - 1);
+        }
+        // 只用于在不求值的上下文中计算参数个数
+        template <typename... Args>
+        char (&argCount(const Args &...))[sizeof...(Args) + 1];
+
+        template <size_t Placeholders, size_t Args>
+        struct Check
+        {
+            static_assert(Placeholders != BAD_FORMAT, "log format string has unmatched '{' or '}'");
+            static_assert(Placeholders == Args, "log format string placeholders do not match the number of arguments");
+            static constexpr int ok()
+            {
+                return 0;
+            }
+        };
+    }
+}
+
+// 编译期检查格式串与参数个数是否一致, fmt必须是字符串字面量
+#define LOG_FMT_CHECK(fmt, ...) Log::Fmt::Check<Log::Fmt::placeholders(fmt), sizeof(Log::Fmt::argCount(__VA_ARGS__)) - 1>::ok()
\ No newline at end of file
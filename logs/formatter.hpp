@@ -1,13 +1,122 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
 #include <sstream>
 #include <ctime>
 #include <vector>
 #include "logMsg.hpp"
+#include "buffer.hpp"
 #include "util.hpp"
 
 namespace Log
 {
+    // 线程局部的日期字符串缓存, 同一秒内的日志直接复用上一次strftime的结果
+    // 每个日期格式化项使用唯一的key, 按key直接映射到固定数量的缓存槽中
+    // 日期格式在strftime的基础上支持秒的小数部分: %3N毫秒, %6N微秒, %9N或%N纳秒,
+    // 小数部分在缓存的字符串上直接填写数字, 不需要重新生成
+    class TimeCache
+    {
+    public:
+        // 将小数格式替换为占位符, strftime会原样输出占位符, 生成后再填写数字
+        static std::string compile(const std::string &fmt)
+        {
+            std::string ret;
+            for (size_t i = 0; i < fmt.size(); ++i)
+            {
+                if (fmt[i] != '%' || i + 1 == fmt.size())
+                {
+                    ret += fmt[i];
+                    continue;
+                }
+                char c = fmt[i + 1];
+                if (c == 'N' || (c >= '1' && c <= '9' && i + 2 < fmt.size() && fmt[i + 2] == 'N'))
+                {
+                    size_t digits = c == 'N' ? 9 : c - '0';
+                    ret.append(digits, PLACEHOLDER);
+                    i += c == 'N' ? 1 : 2;
+                    continue;
+                }
+                // 其余转换(包括%%)交给strftime处理
+                ret += fmt[i];
+                ret += c;
+                ++i;
+            }
+            return ret;
+        }
+        // 生成一个新的缓存key
+        static uint64_t newKey()
+        {
+            static std::atomic<uint64_t> key(0);
+            return ++key;
+        }
+        // 将ctime按fmt格式化到out中, 返回长度
+        // fmt需要先经过compile处理
+        static size_t render(uint64_t key, const char *fmt, time_t ctime, size_t nsec, char *out, size_t cap)
+        {
+            static thread_local Entry entries[SLOTS];
+            Entry &e = entries[key % SLOTS];
+            if (e._key != key || e._sec != ctime)
+            {
+                struct tm t;
+                Util::Date::localTime(ctime, t); // 将当前时间戳进行结构化
+                e._len = strftime(e._text, sizeof(e._text) - 1, fmt, &t);
+                e._key = key;
+                e._sec = ctime;
+                // 记录需要填写小数的位置
+                e._nfrac = 0;
+                for (size_t i = 0; i < e._len && e._nfrac < MAX_FRACTIONS;)
+                {
+                    if (e._text[i] != PLACEHOLDER)
+                    {
+                        ++i;
+                        continue;
+                    }
+                    size_t j = i;
+                    while (j < e._len && j - i < 9 && e._text[j] == PLACEHOLDER)
+                        ++j;
+                    e._frac_pos[e._nfrac] = i;
+                    e._frac_len[e._nfrac] = j - i;
+                    ++e._nfrac;
+                    i = j;
+                }
+            }
+            size_t n = std::min(e._len, cap);
+            memcpy(out, e._text, n);
+            if (e._nfrac > 0)
+            {
+                // 纳秒数补齐为9位, 按需要的位数截取
+                char digits[9];
+                for (int i = 8; i >= 0; --i, nsec /= 10)
+                    digits[i] = '0' + nsec % 10;
+                for (size_t i = 0; i < e._nfrac; ++i)
+                {
+                    if (e._frac_pos[i] >= n)
+                        break;
+                    memcpy(out + e._frac_pos[i], digits, std::min(e._frac_len[i], n - e._frac_pos[i]));
+                }
+            }
+            return n;
+        }
+
+    private:
+        static const size_t SLOTS = 8;
+        static const size_t MAX_FRACTIONS = 4;
+        static const char PLACEHOLDER = '\x01';
+        struct Entry
+        {
+            uint64_t _key = 0;
+            time_t _sec = 0;
+            size_t _len = 0;
+            size_t _nfrac = 0;               // 小数部分的个数
+            size_t _frac_pos[MAX_FRACTIONS]; // 小数部分在_text中的位置
+            size_t _frac_len[MAX_FRACTIONS]; // 小数部分的位数
+            char _text[128];
+        };
+    };
+
     class FormatterItem
     {
     public:
@@ -72,17 +181,15 @@ namespace Log
     {
     private:
         std::string _fmt;
+        uint64_t _key; // 日期缓存的key
 
     public:
-        TimeFormatterItem(const std::string &fmt = "%H:%M:%S") : _fmt(fmt) {}
+        TimeFormatterItem(const std::string &fmt = "%H:%M:%S") : _fmt(TimeCache::compile(fmt)), _key(TimeCache::newKey()) {}
         virtual void format(std::ostream &out, const LogMessage &msg)
         {
-            time_t ctime = msg._ctime;
-            struct tm t;
-            localtime_r(&ctime, &t); // 将当前时间戳进行结构化
             char buffer[128];
-            strftime(buffer, 127, _fmt.c_str(), &t); // 获取当前时间的格式化字符串
-            out << buffer;
+            size_t n = TimeCache::render(_key, _fmt.c_str(), msg._ctime, msg._nsec, buffer, sizeof(buffer)); // 获取当前时间的格式化字符串
+            out.write(buffer, n);
         }
     };
     class TabFormatterItem : public FormatterItem
@@ -116,6 +223,26 @@ namespace Log
         }
     };
 
+    // 编译后的格式化指令, 参数保存在Formatter::_literals中
+    struct FormatOp
+    {
+        enum Code : uint8_t
+        {
+            OP_LITERAL, // 原始字符串
+            OP_TIME,    // 日期, 参数为strftime格式串(以'\0'结尾)
+            OP_THREAD,
+            OP_NAME,
+            OP_FILE,
+            OP_LINE,
+            OP_MSG,
+            OP_LEVEL,
+        };
+        Code _code;
+        uint32_t _off; // 参数在_literals中的偏移
+        uint32_t _len; // 参数长度
+        uint64_t _key; // 日期缓存的key
+    };
+
     class Formatter
     {
     public:
@@ -123,7 +250,10 @@ namespace Log
         Formatter(const std::string &pattern = "[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n")
             : _pattern(pattern)
         {
-            assert(parsePattern());
+            // 不能把parsePattern直接写在assert中, 否则定义NDEBUG后不会解析
+            bool ret = parsePattern();
+            assert(ret);
+            (void)ret;
         }
 
         void format(std::ostream &out, const LogMessage &msg)
@@ -135,6 +265,66 @@ namespace Log
             }
         }
 
+        // 执行编译后的指令, 直接写入调用者提供的缓冲区, 不使用iostream也不分配内存
+        // 与snprintf类似, 返回完整输出需要的长度, 返回值大于cap时只写入了前cap个字节
+        size_t format(char *buf, size_t cap, const LogMessage &msg)
+        {
+            size_t pos = 0;
+            const char *lit = _literals.c_str();
+            for (const FormatOp &op : _ops)
+            {
+                switch (op._code)
+                {
+                case FormatOp::OP_LITERAL:
+                    append(buf, cap, pos, lit + op._off, op._len);
+                    break;
+                case FormatOp::OP_TIME:
+                    appendTime(buf, cap, pos, op._key, lit + op._off, msg);
+                    break;
+                case FormatOp::OP_THREAD:
+                    appendUInt(buf, cap, pos, threadNumber(msg._tid));
+                    break;
+                case FormatOp::OP_NAME:
+                    append(buf, cap, pos, msg._name.data(), msg._name.size());
+                    break;
+                case FormatOp::OP_FILE:
+                    append(buf, cap, pos, msg._file.data(), msg._file.size());
+                    break;
+                case FormatOp::OP_LINE:
+                    appendUInt(buf, cap, pos, msg._line);
+                    break;
+                case FormatOp::OP_MSG:
+                    append(buf, cap, pos, msg._payload.data(), msg._payload.size());
+                    break;
+                case FormatOp::OP_LEVEL:
+                {
+                    const char *lv = LogLevel::levelToStr(msg._lv);
+                    append(buf, cap, pos, lv, strlen(lv));
+                    break;
+                }
+                }
+            }
+            return pos;
+        }
+
+        // 直接格式化到缓冲区当前块的可写区域中, 空间不足时追加新块后重新格式化
+        void format(Buffer &buff, const LogMessage &msg)
+        {
+            char *ptr = buff.writePtr();
+            size_t n = format(ptr, buff.contiguousSize(), msg);
+            if (n > buff.contiguousSize())
+            {
+                buff.reserve(n);
+                format(buff.writePtr(), buff.contiguousSize(), msg);
+            }
+            buff.moveWriter(n);
+        }
+
+        const std::string &pattern()
+        {
+            return _pattern;
+        }
+
         std::string format(const LogMessage &msg)
         {
             std::stringstream ss;
@@ -142,7 +332,7 @@ namespace Log
             //std::cout << ss.str() << std::endl;
             return ss.str();
         }
-        // %d 日期
+        // %d 日期, 子规则为strftime格式, 另外支持%3N毫秒 %6N微秒 %9N纳秒
         // %t 线程ID
         // %c 日志器名称
         // %f 文件名
@@ -175,6 +365,94 @@ namespace Log
         }
 
     private:
+        static void append(char *buf, size_t cap, size_t &pos, const char *data, size_t len)
+        {
+            if (pos < cap)
+                memcpy(buf + pos, data, std::min(len, cap - pos));
+            pos += len;
+        }
+        static void appendUInt(char *buf, size_t cap, size_t &pos, uint64_t v)
+        {
+            char tmp[24];
+            char *p = tmp + sizeof(tmp);
+            do
+            {
+                *--p = '0' + v % 10;
+                v /= 10;
+            } while (v);
+            append(buf, cap, pos, p, tmp + sizeof(tmp) - p);
+        }
+        static void appendTime(char *buf, size_t cap, size_t &pos, uint64_t key, const char *fmt, const LogMessage &msg)
+        {
+            char tmp[128];
+            size_t n = TimeCache::render(key, fmt, msg._ctime, msg._nsec, tmp, sizeof(tmp));
+            append(buf, cap, pos, tmp, n);
+        }
+        // 与std::thread::id的流输出保持一致: libstdc++中输出的是pthread_t的数值
+        static uint64_t threadNumber(const std::thread::id &tid)
+        {
+            if (sizeof(tid) == sizeof(uint64_t))
+            {
+                uint64_t v;
+                memcpy(&v, &tid, sizeof(v));
+                return v;
+            }
+            return std::hash<std::thread::id>()(tid);
+        }
+
+        // 将解析出的kv对编译为指令
+        void compile(const std::string &key, const std::string &value)
+        {
+            FormatOp op;
+            op._off = _literals.size();
+            op._len = 0;
+            op._key = 0;
+            if (key.empty() || key == "T" || key == "n")
+            {
+                op._code = FormatOp::OP_LITERAL;
+                std::string str = key.empty() ? value : (key == "T" ? "\t" : "\n");
+                // 相邻的原始字符串合并为一条指令
+                if (!_ops.empty() && _ops.back()._code == FormatOp::OP_LITERAL &&
+                    _ops.back()._off + _ops.back()._len == _literals.size())
+                {
+                    _literals += str;
+                    _ops.back()._len += str.size();
+                    return;
+                }
+                _literals += str;
+                op._len = str.size();
+            }
+            else if (key == "d")
+            {
+                op._code = FormatOp::OP_TIME;
+                op._key = TimeCache::newKey();
+                std::string fmt = TimeCache::compile(value);
+                _literals += fmt;
+                _literals += '\0';
+                op._len = fmt.size();
+            }
+            else if (key == "t")
+                op._code = FormatOp::OP_THREAD;
+            else if (key == "c")
+                op._code = FormatOp::OP_NAME;
+            else if (key == "f")
+                op._code = FormatOp::OP_FILE;
+            else if (key == "l")
+                op._code = FormatOp::OP_LINE;
+            else if (key == "m")
+                op._code = FormatOp::OP_MSG;
+            else if (key == "p")
+                op._code = FormatOp::OP_LEVEL;
+            else
+            {
+                // 与OtherFormatterItem一致, 未知的格式化字符输出其子规则内容
+                op._code = FormatOp::OP_LITERAL;
+                _literals += value;
+                op._len = value.size();
+            }
+            _ops.push_back(op);
+        }
+
         bool parsePattern()
         {
             // 对格式化字符串进行分割
@@ -199,6 +477,7 @@ namespace Log
                 if(pos + 1 < _pattern.size() && _pattern[pos+1] == '%')
                 {
                     val += "%";
+                    pos += 2;
                     continue;
                 }
                 //走到这里说明遇到了一个%, 后面的是格式化字符串, 前面的原始字符串已经处理完
@@ -237,9 +516,15 @@ namespace Log
                 key.clear();
                 val.clear();
             }
+            //原始字符串在结尾时也需要加入
+            if(!val.empty())
+            {
+                fmt_order.emplace_back("", val);
+            }
             for(auto& fmt : fmt_order)
             {
                 _items.push_back(createItem(fmt.first, fmt.second));
+                compile(fmt.first, fmt.second);
             }
             return true;
         }
@@ -247,5 +532,7 @@ namespace Log
     private:
         std::string _pattern;
         std::vector<Log::FormatterItem::ptr> _items; // 存放格式化类的父类指针, 可以保存子类对象
+        std::vector<FormatOp> _ops;                  // 编译后的格式化指令
+        std::string _literals;                       // 指令使用的原始字符串和日期格式串
     };
 }
\ No newline at end of file
@@ -13,16 +13,132 @@ namespace Log
         return LoggerManager::getLoggerManager()->getRootLogger();
     }   
 
-    #define debug(fmt, ...) debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define info(fmt, ...) info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define warning(fmt, ...) warning(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define error(fmt, ...) error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define fatal(fmt, ...) fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-
-    #define DEBUG(fmt, ...) Log::rootLogger()->debug(fmt, ##__VA_ARGS__)
-    #define INFO(fmt, ...) Log::rootLogger()->info(fmt, ##__VA_ARGS__)
-    #define WARNING(fmt, ...) Log::rootLogger()->warning(fmt, ##__VA_ARGS__)
-    #define ERROR(fmt, ...) Log::rootLogger()->error(fmt, ##__VA_ARGS__)
-    #define FATAL(fmt, ...) Log::rootLogger()->fatal(fmt, ##__VA_ARGS__)
-    
+    // 日志宏使用的默认日志器, 不加锁也不修改引用计数
+    Logger *rootLoggerRaw()
+    {
+        return LoggerManager::getLoggerManager()->getRootLoggerRaw();
+    }
+
+    // 只在sizeof中使用, 让被编译期去除的日志参数仍然被引用, 避免未使用变量的警告
+    template <typename... Args>
+    int discardArgs(const Args &...);
+
+
+    // 编译期的最低日志等级, 低于该等级的日志宏不产生任何代码, 参数也不会被求值
+    // 例如发布版本中使用 -DLOG_ACTIVE_LEVEL=LOG_LEVEL_INFO 去除所有debug日志
+    #define LOG_LEVEL_DEBUG 1
+    #define LOG_LEVEL_INFO 2
+    #define LOG_LEVEL_WARNING 3
+    #define LOG_LEVEL_ERROR 4
+    #define LOG_LEVEL_FATAL 5
+    #define LOG_LEVEL_OFF 6
+    #ifndef LOG_ACTIVE_LEVEL
+    #define LOG_ACTIVE_LEVEL LOG_LEVEL_DEBUG
+    #endif
+    static_assert(LOG_LEVEL_DEBUG == LogLevel::Level::DEBUG && LOG_LEVEL_FATAL == LogLevel::Level::FATAL,
+                  "LOG_LEVEL_* must match LogLevel::Level");
+
+    // 日志宏的格式串: 只有字符串字面量可以保存在静态调用点中
+    // 其他格式串(std::string, 运行时的const char*, 字符数组变量等)每次调用都可能不同, 调用点中不保存格式串
+    template <typename T>
+    struct FormatLiteral
+    {
+        static const bool value = false;
+        static StringView view(const T &)
+        {
+            return StringView();
+        }
+    };
+    template <size_t N>
+    struct FormatLiteral<const char (&)[N]>
+    {
+        static const bool value = true;
+        static constexpr StringView view(const char (&fmt)[N])
+        {
+            return StringView(fmt);
+        }
+    };
+
+    // 为每一处日志调用生成一个静态调用点, 格式串是字符串字面量时在编译期完成初始化
+    #define LOG_CALLSITE(level, fmt) \
+        ([&]() -> const Log::CallSite * { static Log::CallSite site(level, __FILE__, __LINE__, Log::FormatLiteral<decltype(fmt)>::view(fmt)); return &site; }())
+    // 先判断日志器的等级, 满足时才对参数求值并调用method, fmt必须是字符串字面量
+    #define LOG_LAZY(method, level, fmt, ...) \
+        logLazy(LOG_CALLSITE(level, fmt), [&](Log::Logger &lgr, const Log::CallSite *site) { lgr.method(site, ##__VA_ARGS__); })
+    // printf风格的日志宏, 格式串不是字符串字面量时使用直接调用的接口, 每次调用使用临时的调用点
+    #define LOG_LAZY_PRINTF(method, level, fmt, ...) \
+        logLazy(LOG_CALLSITE(level, fmt), [&](Log::Logger &lgr, const Log::CallSite *site) { \
+            if (Log::FormatLiteral<decltype(fmt)>::value)                                      \
+                lgr.method(site, ##__VA_ARGS__);                                               \
+            else                                                                               \
+                lgr.method(__FILE__, __LINE__, fmt, ##__VA_ARGS__); })
+    #define LOG_DISCARD(fmt, ...) ((void)sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_DEBUG
+    #define debug(fmt, ...) LOG_LAZY_PRINTF(debug, Log::LogLevel::Level::DEBUG, fmt, ##__VA_ARGS__)
+    #define DEBUG(fmt, ...) Log::rootLoggerRaw()->debug(fmt, ##__VA_ARGS__)
+    #else
+    #define debug(fmt, ...) discard(sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+    #define DEBUG(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_INFO
+    #define info(fmt, ...) LOG_LAZY_PRINTF(info, Log::LogLevel::Level::INFO, fmt, ##__VA_ARGS__)
+    #define INFO(fmt, ...) Log::rootLoggerRaw()->info(fmt, ##__VA_ARGS__)
+    #else
+    #define info(fmt, ...) discard(sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+    #define INFO(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_WARNING
+    #define warning(fmt, ...) LOG_LAZY_PRINTF(warning, Log::LogLevel::Level::WARNING, fmt, ##__VA_ARGS__)
+    #define WARNING(fmt, ...) Log::rootLoggerRaw()->warning(fmt, ##__VA_ARGS__)
+    #else
+    #define warning(fmt, ...) discard(sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+    #define WARNING(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_ERROR
+    #define error(fmt, ...) LOG_LAZY_PRINTF(error, Log::LogLevel::Level::ERROR, fmt, ##__VA_ARGS__)
+    #define ERROR(fmt, ...) Log::rootLoggerRaw()->error(fmt, ##__VA_ARGS__)
+    #else
+    #define error(fmt, ...) discard(sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+    #define ERROR(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_FATAL
+    #define fatal(fmt, ...) LOG_LAZY_PRINTF(fatal, Log::LogLevel::Level::FATAL, fmt, ##__VA_ARGS__)
+    #define FATAL(fmt, ...) Log::rootLoggerRaw()->fatal(fmt, ##__VA_ARGS__)
+    #else
+    #define fatal(fmt, ...) discard(sizeof(Log::discardArgs(fmt, ##__VA_ARGS__)))
+    #define FATAL(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+    #endif
+
+    // 类型安全的日志宏, 格式串使用{}作为占位符, 例如: LOG_INFO(logger, "user {} login, cost {}ms", name, ms)
+    // 格式串的检查不受编译期最低等级的影响
+    #define LOG_PRINT(logger, level, fmt, ...) \
+        ((void)LOG_FMT_CHECK(fmt, ##__VA_ARGS__), (logger)->LOG_LAZY(print, level, fmt, ##__VA_ARGS__))
+    #define LOG_PRINT_DISCARD(logger, fmt, ...) \
+        ((void)LOG_FMT_CHECK(fmt, ##__VA_ARGS__), (void)sizeof(Log::discardArgs(logger, ##__VA_ARGS__)))
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_DEBUG
+    #define LOG_DEBUG(logger, fmt, ...) LOG_PRINT(logger, Log::LogLevel::Level::DEBUG, fmt, ##__VA_ARGS__)
+    #else
+    #define LOG_DEBUG(logger, fmt, ...) LOG_PRINT_DISCARD(logger, fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_INFO
+    #define LOG_INFO(logger, fmt, ...) LOG_PRINT(logger, Log::LogLevel::Level::INFO, fmt, ##__VA_ARGS__)
+    #else
+    #define LOG_INFO(logger, fmt, ...) LOG_PRINT_DISCARD(logger, fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_WARNING
+    #define LOG_WARNING(logger, fmt, ...) LOG_PRINT(logger, Log::LogLevel::Level::WARNING, fmt, ##__VA_ARGS__)
+    #else
+    #define LOG_WARNING(logger, fmt, ...) LOG_PRINT_DISCARD(logger, fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_ERROR
+    #define LOG_ERROR(logger, fmt, ...) LOG_PRINT(logger, Log::LogLevel::Level::ERROR, fmt, ##__VA_ARGS__)
+    #else
+    #define LOG_ERROR(logger, fmt, ...) LOG_PRINT_DISCARD(logger, fmt, ##__VA_ARGS__)
+    #endif
+    #if LOG_ACTIVE_LEVEL <= LOG_LEVEL_FATAL
+    #define LOG_FATAL(logger, fmt, ...) LOG_PRINT(logger, Log::LogLevel::Level::FATAL, fmt, ##__VA_ARGS__)
+    #else
+    #define LOG_FATAL(logger, fmt, ...) LOG_PRINT_DISCARD(logger, fmt, ##__VA_ARGS__)
+    #endif
 }
\ No newline at end of file
@@ -1,34 +1,114 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
 #include <thread>
 #include "util.hpp"
 #include "level.hpp"
 
 namespace Log
 {
+    // 只读的字符串视图, 不持有数据, 使用者需要保证数据在使用期间有效
+    struct StringView
+    {
+        constexpr StringView() : _data(""), _size(0) {}
+        constexpr StringView(const char *str) : _data(str ? str : ""), _size(str ? __builtin_strlen(str) : 0) {}
+        constexpr StringView(const char *data, size_t size) : _data(data), _size(size) {}
+        StringView(const std::string &str) : _data(str.data()), _size(str.size()) {}
+
+        const char *data() const
+        {
+            return _data;
+        }
+        size_t size() const
+        {
+            return _size;
+        }
+        bool empty() const
+        {
+            return _size == 0;
+        }
+        std::string str() const
+        {
+            return std::string(_data, _size);
+        }
+
+        const char *_data;
+        size_t _size;
+    };
+    inline std::ostream &operator<<(std::ostream &out, const StringView &view)
+    {
+        return out.write(view.data(), view.size());
+    }
+
+    // 调用点描述, 日志宏在每一处展开的位置生成一个静态对象, 保存不会改变的等级、文件名、行号和格式串
+    // 静态对象在编译期完成初始化, 日志调用只需要传递它的地址
+    struct CallSite
+    {
+        // 预解析的printf转换说明, 只保存编码参数需要的信息, 由延迟格式化在第一次调用时填写
+        struct Conv
+        {
+            char _conv;     // 转换字符
+            char _mod;      // 长度修饰
+            uint8_t _stars; // 宽度和精度中'*'的个数
+            int _prec;      // 精度, 字符串只拷贝精度以内的部分
+        };
+        enum State
+        {
+            UNPARSED,    // 还未解析
+            PARSING,     // 某个线程正在解析
+            PARSED,      // 解析完成, 可以使用_convs
+            UNCACHED,    // 转换说明太多, 每次调用时解析
+            UNSUPPORTED, // 存在无法延迟处理的转换
+        };
+        static const size_t MAX_CONVS = 16;
+
+        constexpr CallSite(LogLevel::Level lv, StringView file, size_t line, StringView fmt, bool persistent = true)
+            : _lv(lv), _file(file), _line(line), _fmt(fmt), _persistent(persistent),
+              _state(UNPARSED), _nconvs(0), _convs{} {}
+        CallSite(const CallSite &) = delete;
+        CallSite &operator=(const CallSite &) = delete;
+
+        LogLevel::Level _lv;
+        StringView _file;
+        size_t _line;
+        StringView _fmt;
+        bool _persistent; // 是否为静态对象, 只有静态对象可以被异步缓冲区中的记录引用
+        mutable std::atomic<int> _state;
+        mutable size_t _nconvs;
+        mutable Conv _convs[MAX_CONVS];
+    };
+
+    // 日志消息, 文件名、日志器名和消息内容都是视图, 分别指向调用点、日志器和调用者的缓冲区
     struct LogMessage
     {
         using ptr = std::shared_ptr<LogMessage>;
         size_t _line;         // 行号
-        size_t _ctime;        // 当前时间
+        size_t _ctime;        // 当前时间(秒)
+        size_t _nsec;         // 当前时间秒内的纳秒数
         std::thread::id _tid; // 当前进程id
-        std::string _file;    // 文件名
-        std::string _name;    // 日志器名称
-        std::string _payload; // 日志消息内容
+        StringView _file;     // 文件名
+        StringView _name;     // 日志器名称
+        StringView _payload;  // 日志消息内容
         LogLevel::Level _lv;  // 日志等级
 
-        LogMessage() {}
+        LogMessage() : _line(0), _ctime(0), _nsec(0), _lv(LogLevel::Level::UNKNOW) {}
         LogMessage(
             LogLevel::Level lv,
             size_t line,
-            std::string file,
-            std::string name,
-            std::string payload)
+            StringView file,
+            StringView name,
+            StringView payload)
             : _line(line),
-              _ctime(Util::Date::now()),
               _tid(std::this_thread::get_id()),
               _file(file),
               _name(name),
               _payload(payload),
-              _lv(lv) {}
+              _lv(lv)
+        {
+            Util::Clock::now(_ctime, _nsec);
+        }
     };
 }
\ No newline at end of file
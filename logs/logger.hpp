@@ -13,6 +13,11 @@
 #include "util.hpp"
 #include "out.hpp"
 #include "async.hpp"
+#include "staging.hpp"
+#include "channel.hpp"
+#include "deferred.hpp"
+#include "fmt.hpp"
+#include "crash.hpp"
 
 namespace Log
 {
@@ -27,138 +32,360 @@ namespace Log
             : _logger_name(logger_name),
               _limit_level(level),
               _pfmt(pfmt),
-              _outputs(outputs) {}
+              _outputs(outputs)
+        {
+            buildRoutes();
+            // 登记到崩溃处理中, 只有安装了崩溃处理时才会用到
+            CrashHandler::add(crashEntry, this);
+        }
+        virtual ~Logger()
+        {
+            CrashHandler::remove(this);
+        }
 
         std::string loggerName()
         {
             return _logger_name;
         }
+        // 判断某个等级的日志是否需要输出, 只需要一次relaxed的原子读取
+        bool enabled(LogLevel::Level level) const
+        {
+            return _limit_level.load(std::memory_order_relaxed) <= level;
+        }
+        // 由日志宏调用: 先判断等级, 满足时才执行call, 日志参数在call中求值
+        template <typename Call>
+        void logLazy(const CallSite *site, const Call &call)
+        {
+            if (enabled(site->_lv))
+                call(*this, site);
+        }
+        // 低于编译期最低等级的日志宏展开为对该函数的调用, 参数不会被求值
+        void discard(size_t) const {}
+        // 等待调用之前写入的日志全部交给输出并刷新, timeout_ms为0时一直等待, 超时返回false
+        virtual bool flush(size_t timeout_ms = 0)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &out : _outputs)
+            {
+                out->flush();
+            }
+            return true;
+        }
 
+        // 由日志宏调用, 调用点中保存了等级、文件名、行号和格式串
         // 构造日志消息对象, 对日志消息进行格式化, 输出字符串, 然后进行落地输出
-        void debug(const std::string &file, size_t line, const std::string &fmt, ...)
+        void debug(const CallSite *site, ...)
         {
             // 1. 判断输出等级是否满足, 不满足就返回
-            if (_limit_level > LogLevel::Level::DEBUG)
+            if (!enabled(site->_lv))
             {
                 return;
             }
             // 2. 对fmt和不定参函数进行解析, 形成字符串
-            char *res;
             va_list p; // 不定参指针
-            va_start(p, fmt);
-            int ret = vasprintf(&res, fmt.c_str(), p);
-            // std::cout << "res = " << res << std::endl;
-            if (ret == -1)
+            va_start(p, site);
+            logv(*site, p);
+            va_end(p);
+        }
+        void info(const CallSite *site, ...)
+        {
+            // 1. 判断输出等级是否满足, 不满足就返回
+            if (!enabled(site->_lv))
             {
-                std::cout << "vasprintf error" << std::endl;
                 return;
             }
+            // 2. 对fmt和不定参函数进行解析, 形成字符串
+            va_list p; // 不定参指针
+            va_start(p, site);
+            logv(*site, p);
             va_end(p);
-            serialize(LogLevel::Level::DEBUG, file, line, res);
-            free(res);
         }
-        void info(const std::string &file, size_t line, const std::string &fmt, ...)
+        void warning(const CallSite *site, ...)
         {
             // 1. 判断输出等级是否满足, 不满足就返回
-            if (_limit_level > LogLevel::Level::INFO)
+            if (!enabled(site->_lv))
             {
                 return;
             }
             // 2. 对fmt和不定参函数进行解析, 形成字符串
-            char *res;
             va_list p; // 不定参指针
-            va_start(p, fmt);
-            int ret = vasprintf(&res, fmt.c_str(), p);
-            if (ret == -1)
+            va_start(p, site);
+            logv(*site, p);
+            va_end(p);
+        }
+        void error(const CallSite *site, ...)
+        {
+            // 1. 判断输出等级是否满足, 不满足就返回
+            if (!enabled(site->_lv))
             {
-                std::cout << "vasprintf error" << std::endl;
                 return;
             }
+            // 2. 对fmt和不定参函数进行解析, 形成字符串
+            va_list p; // 不定参指针
+            va_start(p, site);
+            logv(*site, p);
             va_end(p);
-            serialize(LogLevel::Level::INFO, file, line, res);
-            free(res);
         }
-        void warning(const std::string &file, size_t line, const std::string &fmt, ...)
-        { // 1. 判断输出等级是否满足, 不满足就返回
-            if (_limit_level > LogLevel::Level::WARNING)
+        void fatal(const CallSite *site, ...)
+        {
+            // 1. 判断输出等级是否满足, 不满足就返回
+            if (!enabled(site->_lv))
             {
                 return;
             }
             // 2. 对fmt和不定参函数进行解析, 形成字符串
-            char *res;
             va_list p; // 不定参指针
+            va_start(p, site);
+            logv(*site, p);
+            va_end(p);
+        }
+        // 直接调用时使用的接口, 文件名和格式串在调用期间有效即可
+        void debug(const std::string &file, size_t line, const std::string &fmt, ...)
+        {
+            if (!enabled(LogLevel::Level::DEBUG))
+            {
+                return;
+            }
+            CallSite site(LogLevel::Level::DEBUG, file, line, fmt.c_str(), false);
+            va_list p;
             va_start(p, fmt);
-            int ret = vasprintf(&res, fmt.c_str(), p);
-            if (ret == -1)
+            logv(site, p);
+            va_end(p);
+        }
+        void info(const std::string &file, size_t line, const std::string &fmt, ...)
+        {
+            if (!enabled(LogLevel::Level::INFO))
             {
-                std::cout << "vasprintf error" << std::endl;
                 return;
             }
+            CallSite site(LogLevel::Level::INFO, file, line, fmt.c_str(), false);
+            va_list p;
+            va_start(p, fmt);
+            logv(site, p);
             va_end(p);
-            serialize(LogLevel::Level::WARNING, file, line, res);
-            free(res);
         }
-        void error(const std::string &file, size_t line, const std::string &fmt, ...)
-        { // 1. 判断输出等级是否满足, 不满足就返回
-            if (_limit_level > LogLevel::Level::ERROR)
+        void warning(const std::string &file, size_t line, const std::string &fmt, ...)
+        {
+            if (!enabled(LogLevel::Level::WARNING))
             {
                 return;
             }
-            // 2. 对fmt和不定参函数进行解析, 形成字符串
-            char *res;
-            va_list p; // 不定参指针
+            CallSite site(LogLevel::Level::WARNING, file, line, fmt.c_str(), false);
+            va_list p;
             va_start(p, fmt);
-            int ret = vasprintf(&res, fmt.c_str(), p);
-            if (ret == -1)
+            logv(site, p);
+            va_end(p);
+        }
+        void error(const std::string &file, size_t line, const std::string &fmt, ...)
+        {
+            if (!enabled(LogLevel::Level::ERROR))
             {
-                std::cout << "vasprintf error" << std::endl;
                 return;
             }
+            CallSite site(LogLevel::Level::ERROR, file, line, fmt.c_str(), false);
+            va_list p;
+            va_start(p, fmt);
+            logv(site, p);
             va_end(p);
-            serialize(LogLevel::Level::ERROR, file, line, res);
-            free(res);
         }
         void fatal(const std::string &file, size_t line, const std::string &fmt, ...)
-        { // 1. 判断输出等级是否满足, 不满足就返回
-            if (_limit_level > LogLevel::Level::FATAL)
+        {
+            if (!enabled(LogLevel::Level::FATAL))
             {
                 return;
             }
-            // 2. 对fmt和不定参函数进行解析, 形成字符串
-            char *res;
-            va_list p; // 不定参指针
+            CallSite site(LogLevel::Level::FATAL, file, line, fmt.c_str(), false);
+            va_list p;
             va_start(p, fmt);
-            int ret = vasprintf(&res, fmt.c_str(), p);
-            if (ret == -1)
+            logv(site, p);
+            va_end(p);
+        }
+        // 类型安全的日志接口, 格式串使用{}作为占位符, 格式化结果写入栈上的缓冲区
+        // 通常通过LOG_DEBUG等宏调用, 宏会在编译期检查占位符与参数个数是否一致
+        template <typename... Args>
+        void print(const CallSite *site, const Args &...args)
+        {
+            if (!enabled(site->_lv))
             {
-                std::cout << "vasprintf error" << std::endl;
                 return;
             }
-            va_end(p);
-            serialize(LogLevel::Level::FATAL, file, line, res);
-            free(res);
+            char buf[1024];
+            Fmt::Writer writer(buf, sizeof(buf));
+            Fmt::format(writer, site->_fmt.data(), args...);
+            logText(*site, writer.c_str(), writer.size());
+        }
+        template <typename... Args>
+        void print(LogLevel::Level level, const char *file, size_t line, const char *fmt, const Args &...args)
+        {
+            if (!enabled(level))
+            {
+                return;
+            }
+            CallSite site(level, file, line, fmt, false);
+            print(&site, args...);
         }
 
     protected:
-        virtual void log(const char *data, size_t len) = 0;
-        void serialize(LogLevel::Level level, const std::string &file, size_t line, const char *str)
-        {
-            // 3. 构建logMsg对象
-            LogMessage msg(level, line, file, _logger_name, str);
-            // 4. 对logMsg进行格式化
-            std::stringstream ss;
-            _pfmt->format(ss, msg);
+        // 对fmt和不定参数进行格式化, 然后构建日志消息进行输出
+        // 优先格式化到栈上的缓冲区, 超长时使用线程局部的缓冲区, 不在每次调用时分配内存
+        virtual void logv(const CallSite &site, va_list ap)
+        {
+            char buf[1024];
+            va_list args;
+            va_copy(args, ap);
+            int ret = vsnprintf(buf, sizeof(buf), site._fmt.data(), args);
+            va_end(args);
+            if (ret < 0)
+            {
+                std::cout << "vsnprintf error" << std::endl;
+                return;
+            }
+            if ((size_t)ret < sizeof(buf))
+                return logText(site, buf, ret);
+            static thread_local std::vector<char> large;
+            large.resize(ret + 1);
+            vsnprintf(large.data(), large.size(), site._fmt.data(), ap);
+            logText(site, large.data(), ret);
+        }
+        // 消息内容已经格式化完成, 构建日志消息进行输出
+        virtual void logText(const CallSite &site, const char *str, size_t len)
+        {
+            serialize(site, str, len);
+        }
+        virtual void log(const char *data, size_t len, LogLevel::Level level) = 0;
+        void serialize(const CallSite &site, const char *str, size_t len)
+        {
+            // 3. 构建logMsg对象, 只引用调用点、日志器名和消息内容, 不拷贝字符串
+            LogMessage msg(site._lv, site._line, site._file, _logger_name, StringView(str, len));
+            if (!_routes.empty())
+                return logRoutes(msg);
+            // 4. 对logMsg进行格式化, 优先写入栈上的缓冲区, 超长时使用线程局部的缓冲区
+            char buf[4096];
+            size_t n = _pfmt->format(buf, sizeof(buf), msg);
+            if (n > sizeof(buf))
+            {
+                static thread_local std::vector<char> large;
+                large.resize(n);
+                _pfmt->format(large.data(), n, msg);
+                return log(large.data(), n, site._lv);
+            }
             // 5. 对格式化后的内容进行输出
-            // std::cout << "serialize = "<<ss.str() << std::endl;
-            log(ss.str().c_str(), ss.str().size());
+            log(buf, n, site._lv);
+        }
+        // 输出设置了自己的等级或格式化器时按路由输出, 由同步日志器实现, 异步日志器在异步线程中处理路由
+        virtual void logRoutes(const LogMessage &msg)
+        {
+            (void)msg;
+        }
+        // 按路由格式化一条日志, 每个格式化器最多格式化一次, 再交给write(route, data, len)
+        template <typename Write>
+        void formatRoutes(const LogMessage &msg, Write &write)
+        {
+            static thread_local std::vector<char> large;
+            char buf[4096];
+            const char *data = buf;
+            size_t n = 0;
+            Formatter *last = nullptr;
+            for (auto &route : _routes)
+            {
+                if (msg._lv < route._level)
+                    continue;
+                // 同一个格式化器的路由相邻, 格式化的结果直接复用
+                if (route._pfmt.get() != last)
+                {
+                    last = route._pfmt.get();
+                    n = last->format(buf, sizeof(buf), msg);
+                    data = buf;
+                    if (n > sizeof(buf))
+                    {
+                        large.resize(n);
+                        last->format(large.data(), n, msg);
+                        data = large.data();
+                    }
+                }
+                write(route, data, n);
+            }
+        }
+        // 输出使用的格式化器
+        Formatter::ptr outputFormatter(size_t idx)
+        {
+            const Formatter::ptr &pfmt = _outputs[idx]->formatter();
+            return pfmt ? pfmt : _pfmt;
+        }
+
+        // 进程崩溃时由信号处理函数调用, 将崩溃记录写到所有输出, 只能使用异步信号安全的调用
+        virtual void crashDrain(const char *record, size_t len)
+        {
+            crashWrite("[", 1);
+            crashWrite(_logger_name.data(), _logger_name.size());
+            crashWrite("][FATAL]\t", 9);
+            crashWrite(record, len);
+        }
+        void crashWrite(const char *data, size_t len)
+        {
+            for (auto &out : _outputs)
+                out->crashWrite(data, len);
+        }
+        static void crashEntry(void *ctx, const char *record, size_t len)
+        {
+            static_cast<Logger *>(ctx)->crashDrain(record, len);
+        }
+
+    private:
+        // 根据各输出的等级和格式化器建立路由, 所有输出都使用日志器的格式化器和等级时不需要路由
+        // 所有输出都不需要的等级直接提高日志器的等级, 这样的日志在格式化之前就被丢弃
+        void buildRoutes()
+        {
+            LogLevel::Level limit = _limit_level.load(std::memory_order_relaxed);
+            LogLevel::Level lowest = LogLevel::Level::OFF;
+            for (size_t i = 0; i < _outputs.size(); ++i)
+            {
+                Formatter::ptr pfmt = outputFormatter(i);
+                LogLevel::Level level = std::max(_outputs[i]->level(), limit);
+                lowest = std::min(lowest, level);
+                // 模式相同的格式化器视为同一个, 只格式化一次
+                if (pfmt->pattern() == _pfmt->pattern())
+                    pfmt = _pfmt;
+                for (auto &route : _routes)
+                {
+                    if (route._pfmt->pattern() == pfmt->pattern())
+                        pfmt = route._pfmt;
+                }
+                auto it = std::find_if(_routes.begin(), _routes.end(), [&](const Route &route)
+                                       { return route._pfmt == pfmt && route._level == level; });
+                if (it == _routes.end())
+                {
+                    // 插入到同一个格式化器的最后一条路由之后, 保持相邻
+                    auto pos = std::find_if(_routes.rbegin(), _routes.rend(), [&](const Route &route)
+                                            { return route._pfmt == pfmt; })
+                                   .base();
+                    if (pos == _routes.begin())
+                        pos = _routes.end();
+                    it = _routes.insert(pos, Route{pfmt, level, std::vector<size_t>()});
+                }
+                it->_outputs.push_back(i);
+            }
+            if (!_outputs.empty() && lowest > limit)
+                _limit_level.store(lowest, std::memory_order_relaxed);
+            if (_routes.size() == 1 && _routes[0]._pfmt == _pfmt)
+                _routes.clear();
         }
 
     protected:
+        // 使用同一个格式化器和最低等级的一组输出
+        struct Route
+        {
+            Formatter::ptr _pfmt;         // 格式化器
+            LogLevel::Level _level;       // 最低等级
+            std::vector<size_t> _outputs; // 输出在_outputs中的下标
+        };
+
         std::mutex _mutex;                         // 互斥锁
         std::string _logger_name;                  // 日志器名
         std::atomic<LogLevel::Level> _limit_level; // 控制日志输出等级
         Formatter::ptr _pfmt;                      // 格式化器
         std::vector<Output::ptr> _outputs;         // 存储输出器
+        std::vector<Route> _routes;                // 输出的路由, 为空表示所有输出使用相同的格式化器和等级
     };
 
     class SyncLogger : public Logger
@@ -174,7 +401,7 @@ namespace Log
         }
 
     protected:
-        void log(const char *data, size_t len)
+        void log(const char *data, size_t len, LogLevel::Level level)
         {
             // 释放时会自动解锁
             std::unique_lock<std::mutex> _lock(_mutex);
@@ -185,8 +412,22 @@ namespace Log
             for (auto &out : _outputs)
             {
                 out->log(data, len);
+                out->commit(len, level);
             }
         }
+        void logRoutes(const LogMessage &msg)
+        {
+            std::unique_lock<std::mutex> _lock(_mutex);
+            auto write = [this, &msg](const Route &route, const char *data, size_t len)
+            {
+                for (size_t idx : route._outputs)
+                {
+                    _outputs[idx]->log(data, len);
+                    _outputs[idx]->commit(len, msg._lv);
+                }
+            };
+            formatRoutes(msg, write);
+        }
     };
 
     class AsyncLogger : public Logger
@@ -196,39 +437,363 @@ namespace Log
                     LogLevel::Level level,
                     Formatter::ptr pfmt,
                     std::vector<Output::ptr> outputs,
-                    AsyncType looper_type = AsyncType::ASYNC_SAFE)
+                    AsyncType async_type = AsyncType::ASYNC_SAFE,
+                    LooperType looper_type = LooperType::LOOPER_MUTEX,
+                    size_t ring_size = RING_DEFAULT_SIZE,
+                    size_t staging_size = 0,
+                    size_t staging_interval = STAGING_DEFAULT_INTERVAL,
+                    bool deferred = false,
+                    size_t block_timeout = ASYNC_DEFAULT_TIMEOUT,
+                    LogLevel::Level drop_level = LogLevel::Level::WARNING,
+                    size_t flush_interval = 0,
+                    const AsyncExecutor::ptr &executor = AsyncExecutor::ptr(),
+                    const std::vector<ChannelConfig> &channels = std::vector<ChannelConfig>())
             : Logger(logger_name, level, pfmt, outputs),
-              _plooper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::realLog, this, std::placeholders::_1), looper_type))
+              _deferred(deferred || !_routes.empty()),
+              _flush_interval(flush_interval),
+              _last_flush(std::chrono::steady_clock::now()),
+              _channels(createChannels(outputs, channels)),
+              _plooper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::realLog, this, std::placeholders::_1, std::placeholders::_2),
+                                                     async_type, looper_type, ring_size,
+                                                     std::bind(&AsyncLogger::flushOutputs, this, true), executor))
         {
             // std::cout << "AsyncLogger construction" << std::endl;
+            // 按路由输出时强制延迟格式化, 每条日志在异步线程中对每个格式化器只格式化一次
+            for (size_t i = 0; i < _routes.size(); ++i)
+            {
+                _route_text.emplace_back(new Buffer());
+                _route_level.push_back(LogLevel::Level::UNKNOW);
+            }
+            for (size_t i = 0; i < _outputs.size(); ++i)
+                _all_outputs.push_back(i);
+            _plooper->setBackpressure(block_timeout, drop_level);
+            size_t wakeup = 0;
+            if (staging_size > 0)
+            {
+                // 开启线程暂存区后, 消费者需要定时唤醒收集长时间未发布的数据
+                _staging = std::make_shared<StagingArea>(_plooper, staging_size, staging_interval);
+                wakeup = staging_interval;
+            }
+            // 定时刷新也依赖消费者定时唤醒
+            if (_flush_interval > 0 && (wakeup == 0 || _flush_interval < wakeup))
+                wakeup = _flush_interval;
+            // 按时间间隔同步的输出在没有新日志时也需要定时唤醒消费者完成同步
+            for (auto &out : _outputs)
+            {
+                size_t interval = out->syncInterval();
+                if (interval > 0 && (wakeup == 0 || interval < wakeup))
+                    wakeup = interval;
+            }
+            if (wakeup > 0)
+                _plooper->setWakeupInterval(wakeup);
+        }
+        ~AsyncLogger()
+        {
+            // 先将各线程暂存的数据发布出去, 再等待异步线程处理完所有数据
+            if (_staging)
+                _staging->flushAll();
+            _plooper->stop();
+            // 成员析构之前就注销, 崩溃处理不会访问已经析构的缓冲区
+            CrashHandler::remove(this);
+        }
+        // 先发布各线程暂存的数据, 再等待异步线程处理完调用之前写入的所有日志并刷新输出
+        bool flush(size_t timeout_ms = 0)
+        {
+            if (_staging)
+                _staging->flushAll();
+            return _plooper->flush(timeout_ms);
+        }
+        // 缓冲区满时按照策略丢弃的日志条数和字节数
+        size_t droppedMessages()
+        {
+            return _plooper->droppedMessages();
+        }
+        size_t droppedBytes()
+        {
+            return _plooper->droppedBytes();
         }
 
     protected:
-        void log(const char *data, size_t len)
+        // 先写出还没有输出的日志, 再写崩溃记录
+        // 延迟格式化模式下缓冲区中是二进制记录, 无法在信号处理函数中格式化, 只写出已经格式化的部分
+        void crashDrain(const char *record, size_t len)
+        {
+            // 独立队列中的数据比异步缓冲区中的更早, 先写到各自的输出
+            for (size_t i = 0; i < _channels.size(); ++i)
+            {
+                if (!_channels[i])
+                    continue;
+                Output *out = _outputs[i].get();
+                auto write = [out](const char *data, size_t n)
+                { out->crashWrite(data, n); };
+                _channels[i]->drainUnsafe(write);
+            }
+            auto write = [this](const char *data, size_t n)
+            { crashWrite(data, n); };
+            if (_deferred)
+            {
+                _text.forEachSegment(write);
+                for (size_t r = 0; r < _route_text.size(); ++r)
+                {
+                    for (size_t idx : _routes[r]._outputs)
+                    {
+                        Output *out = _outputs[idx].get();
+                        auto route_write = [out](const char *data, size_t n)
+                        { out->crashWrite(data, n); };
+                        _route_text[r]->forEachSegment(route_write);
+                    }
+                }
+            }
+            else
+            {
+                _plooper->drainUnsafe(write);
+                if (_staging)
+                    _staging->drainUnsafe(write);
+            }
+            Logger::crashDrain(record, len);
+        }
+
+        void logv(const CallSite &site, va_list ap)
+        {
+            if (!_deferred)
+                return Logger::logv(site, ap);
+            // 延迟格式化: 只编码原始参数, 格式化工作交给异步线程
+            static thread_local std::vector<char> record;
+            record.clear();
+            if (!DeferredRecord::encode(record, site, ap))
+            {
+                // 格式串中有无法延迟处理的转换(如%n, %m), 在调用线程格式化
+                return Logger::logv(site, ap);
+            }
+            log(record.data(), record.size(), site._lv);
+        }
+        void logText(const CallSite &site, const char *str, size_t len)
+        {
+            if (!_deferred)
+                return Logger::logText(site, str, len);
+            static thread_local std::vector<char> record;
+            record.clear();
+            DeferredRecord::encodeFormatted(record, site, str, len);
+            log(record.data(), record.size(), site._lv);
+        }
+
+        void log(const char *data, size_t len, LogLevel::Level level)
         {
             // 异步日志器的写入本质上是向生产者缓冲区中写入, 由异步线程将数据从缓冲区输出到指定位置
             // std::cout << "async log" << std::endl;
             // std::cout << data;
-            _plooper->push(data, len);
+            if (_staging)
+            {
+                // FATAL日志立即发布, 防止进程崩溃时丢失暂存的数据
+                _staging->push(data, len, level, level >= LogLevel::Level::FATAL);
+                return;
+            }
+            _plooper->push(data, len, level);
             // std::cout << "push data: " << data << std::endl;
         }
 
-        void realLog(Buffer &buff)
+        void realLog(Buffer &buff, LogLevel::Level level)
         {
+            // 发布各线程暂存区中超时未发布的数据, 在下一批中输出
+            if (_staging)
+                _staging->collect();
             // 异步线程不需要上锁, 因为异步线程是单个执行流串行化执行, 不存在线程安全问题
             if (_outputs.empty())
             {
                 return;
             }
-            for (auto &out : _outputs)
+            if (!_routes.empty())
+            {
+                writeRoutes(buff);
+            }
+            else if (_deferred)
+            {
+                // 延迟格式化模式下缓冲区中是二进制记录, 先解码格式化到文本缓冲区
+                auto format = [this](const LogMessage &msg)
+                { _pfmt->format(_text, msg); };
+                decode(buff, format);
+                writeBatch(_text, level, _all_outputs);
+                // 格式化大记录后多出来的块在重置时归还给块池
+                _text.reset();
+            }
+            else
+            {
+                writeBatch(buff, level, _all_outputs);
+            }
+            // 有日志被丢弃时, 在压力解除后输出一条说明
+            size_t msgs, bytes;
+            if (_plooper->takeDropped(msgs, bytes))
+                reportDropped(msgs, bytes);
+            for (size_t i = 0; i < _channels.size(); ++i)
+            {
+                if (_channels[i] && _channels[i]->takeDropped(msgs, bytes))
+                    reportChannelDropped(i, msgs, bytes);
+            }
+            // 定时刷新输出
+            if (_flush_interval > 0 &&
+                std::chrono::steady_clock::now() - _last_flush >= std::chrono::milliseconds(_flush_interval))
+                flushOutputs(false);
+        }
+
+        // 将一批格式化后的数据写到targets中的输出
+        void writeBatch(Buffer &text, LogLevel::Level level, const std::vector<size_t> &targets)
+        {
+            // 缓冲区由多个块组成, 按段交给输出, 不需要合并成连续的内存
+            _iov.clear();
+            text.segments(_iov);
+            for (size_t idx : targets)
+            {
+                if (!hasChannel(idx))
+                    _outputs[idx]->logv(_iov.data(), _iov.size());
+            }
+            // 整批写入之后再按各输出的持久化策略同步, 一批日志最多只需要一次fsync
+            size_t len = text.readableSize();
+            for (size_t idx : targets)
+            {
+                if (!hasChannel(idx))
+                    _outputs[idx]->commit(len, level);
+            }
+            // 有独立队列的输出共享同一批数据: 批次直接接管缓冲区中的块, 不拷贝
+            if (len == 0)
+                return;
+            OutputBatch::ptr batch;
+            for (size_t idx : targets)
+            {
+                if (!hasChannel(idx))
+                    continue;
+                if (!batch)
+                {
+                    batch = std::make_shared<OutputBatch>(level);
+                    batch->_buff.swap(text);
+                }
+                _channels[idx]->push(batch);
+            }
+        }
+        // 解码一批记录, 按路由格式化到各路由的文本缓冲区, 每条日志对每个格式化器只格式化一次
+        void writeRoutes(Buffer &records)
+        {
+            auto format = [this](const LogMessage &msg)
+            {
+                auto append = [this, &msg](const Route &route, const char *data, size_t n)
+                {
+                    size_t r = &route - _routes.data();
+                    _route_text[r]->push(data, n);
+                    _route_level[r] = std::max(_route_level[r], msg._lv);
+                };
+                formatRoutes(msg, append);
+            };
+            decode(records, format);
+            for (size_t r = 0; r < _routes.size(); ++r)
+            {
+                writeBatch(*_route_text[r], _route_level[r], _routes[r]._outputs);
+                _route_text[r]->reset();
+                _route_level[r] = LogLevel::Level::UNKNOW;
+            }
+        }
+
+        // 在异步线程中刷新所有输出, wait为真时等待独立队列写完并刷新
+        void flushOutputs(bool wait)
+        {
+            for (size_t i = 0; i < _outputs.size(); ++i)
+            {
+                if (!hasChannel(i))
+                    _outputs[i]->flush();
+                else if (wait)
+                    _channels[i]->flush();
+                else
+                    _channels[i]->requestFlush();
+            }
+            _last_flush = std::chrono::steady_clock::now();
+        }
+
+        void reportDropped(size_t msgs, size_t bytes)
+        {
+            char payload[128];
+            int n = snprintf(payload, sizeof(payload), "%zu messages (%zu bytes) dropped", msgs, bytes);
+            for (size_t i = 0; i < _outputs.size(); ++i)
+                writeNotice(i, payload, n);
+        }
+        void reportChannelDropped(size_t idx, size_t batches, size_t bytes)
+        {
+            char payload[128];
+            int n = snprintf(payload, sizeof(payload), "%zu batches (%zu bytes) dropped by the output queue", batches, bytes);
+            writeNotice(idx, payload, n);
+        }
+        // 向第idx个输出写入一条日志器自己产生的警告, 有独立队列时不受队列容量限制
+        // 与普通日志一样遵守输出的最低等级, 只接收更高等级的输出不会收到这条警告
+        void writeNotice(size_t idx, const char *payload, size_t n)
+        {
+            if (LogLevel::Level::WARNING < std::max(_outputs[idx]->level(), _limit_level.load(std::memory_order_relaxed)))
+                return;
+            LogMessage msg(LogLevel::Level::WARNING, __LINE__, __FILE__, _logger_name, StringView(payload, n));
+            char buf[4096];
+            size_t len = std::min(outputFormatter(idx)->format(buf, sizeof(buf), msg), sizeof(buf));
+            if (!hasChannel(idx))
+                return _outputs[idx]->log(buf, len);
+            OutputBatch::ptr batch = std::make_shared<OutputBatch>(LogLevel::Level::WARNING);
+            batch->_buff.push(buf, len);
+            _channels[idx]->push(batch, true);
+        }
+
+        bool hasChannel(size_t idx)
+        {
+            return idx < _channels.size() && _channels[idx];
+        }
+        // 为配置了独立队列的输出创建消费者, 都没有配置时返回空数组
+        // 异步线程在刷新和队列满时会等待独立队列, 所以独立队列不能使用异步线程所在的执行器, 每个队列使用自己的线程
+        static std::vector<OutputChannel::ptr> createChannels(const std::vector<Output::ptr> &outputs,
+                                                              const std::vector<ChannelConfig> &configs)
+        {
+            std::vector<OutputChannel::ptr> channels;
+            for (size_t i = 0; i < configs.size() && i < outputs.size(); ++i)
             {
-                // buff.getPtrPos();
-                out->log(buff.begin(), buff.readableSize());
+                if (configs[i]._max_bytes == 0)
+                    continue;
+                channels.resize(outputs.size());
+                channels[i] = std::make_shared<OutputChannel>(outputs[i], configs[i]);
+            }
+            return channels;
+        }
+
+        // 在异步线程中将二进制记录逐条解码, 交给f(msg)格式化
+        template <typename F>
+        void decode(Buffer &records, F &f)
+        {
+            LogMessage msg;
+            msg._name = _logger_name;
+            std::string payload;
+            // 每条记录都是一次完整的写入, 不会跨越块, 逐段解码即可
+            _records.clear();
+            records.segments(_records);
+            for (auto &seg : _records)
+            {
+                const char *data = static_cast<const char *>(seg.iov_base);
+                size_t len = seg.iov_len;
+                while (len > 0)
+                {
+                    size_t n = DeferredRecord::decode(data, len, msg, payload);
+                    if (n == 0)
+                        break;
+                    f(msg);
+                    data += n;
+                    len -= n;
+                }
             }
         }
 
     private:
+        bool _deferred;                                    // 是否在异步线程中进行格式化
+        Buffer _text;                                      // 延迟格式化模式下存放格式化后的文本
+        std::vector<struct iovec> _iov;                    // 交给输出的数据段
+        std::vector<struct iovec> _records;                // 待解码的记录段
+        std::vector<std::unique_ptr<Buffer>> _route_text;  // 按路由输出时各路由格式化后的文本
+        std::vector<LogLevel::Level> _route_level;         // 各路由这一批日志的最高等级
+        std::vector<size_t> _all_outputs;                  // 所有输出的下标
+        size_t _flush_interval;                            // 定时刷新输出的间隔(毫秒), 0表示不定时刷新
+        std::chrono::steady_clock::time_point _last_flush; // 上次刷新输出的时间
+        std::vector<OutputChannel::ptr> _channels;         // 各输出的独立队列, 与_outputs一一对应, 为空表示直接写入
         AsyncLooper::ptr _plooper;
+        StagingArea::ptr _staging;                         // 线程暂存区, 为空表示直接写入异步循环
     };
 
     enum LoggerType // 日志器类型
@@ -243,7 +808,15 @@ namespace Log
         LoggerBuilder()
             : _logger_type(SYNC_LOGGER),
               _limit_level(LogLevel::Level::DEBUG),
-              _async_type(AsyncType::ASYNC_SAFE)
+              _async_type(AsyncType::ASYNC_SAFE),
+              _looper_type(LooperType::LOOPER_MUTEX),
+              _ring_size(RING_DEFAULT_SIZE),
+              _staging_size(0),
+              _staging_interval(STAGING_DEFAULT_INTERVAL),
+              _deferred(false),
+              _block_timeout(ASYNC_DEFAULT_TIMEOUT),
+              _drop_level(LogLevel::Level::WARNING),
+              _flush_interval(0)
         {
         }
         void buildLoggerType(LoggerType type) // 创建日志器类型(同步/异步)
@@ -272,6 +845,96 @@ namespace Log
         {
             _async_type = AsyncType::ASYNC_UNSAFE;
         }
+        // 异步缓冲区满时的处理策略, timeout_ms用于ASYNC_BLOCK_TIMEOUT, drop_level用于ASYNC_DROP_LEVEL
+        void buildBackpressure(AsyncType async_type,
+                               size_t timeout_ms = ASYNC_DEFAULT_TIMEOUT,
+                               LogLevel::Level drop_level = LogLevel::Level::WARNING)
+        {
+            _async_type = async_type;
+            _block_timeout = timeout_ms;
+            _drop_level = drop_level;
+        }
+        // 异步日志器使用无锁环形缓冲区, 生产者只操作原子变量
+        void buildLockFreeAsync(size_t ring_size = RING_DEFAULT_SIZE)
+        {
+            _looper_type = LooperType::LOOPER_RING;
+            _ring_size = ring_size;
+        }
+        // 异步日志器的每个生产者线程先写入线程暂存区, 达到大小或时间阈值后再整批发布
+        void buildThreadStaging(size_t staging_size = STAGING_DEFAULT_SIZE,
+                                size_t staging_interval = STAGING_DEFAULT_INTERVAL)
+        {
+            _staging_size = staging_size;
+            _staging_interval = staging_interval;
+        }
+        // 异步日志器在调用线程只拷贝原始参数, 由异步线程完成全部格式化工作
+        void buildDeferredFormat()
+        {
+            _deferred = true;
+        }
+        // 异步日志器每隔interval_ms毫秒刷新一次输出
+        void buildFlushInterval(size_t interval_ms)
+        {
+            _flush_interval = interval_ms;
+        }
+        // 异步日志器不创建自己的线程, 由共享执行器的工作线程处理, 多个日志器可以使用同一个执行器
+        void buildExecutor(const AsyncExecutor::ptr &executor)
+        {
+            _executor = executor;
+        }
+        // 最近创建的输出使用独立的队列和消费者, 慢的输出不会拖慢其他输出, 队列满时按照async_type处理
+        void buildOutputQueue(size_t max_bytes = CHANNEL_DEFAULT_SIZE,
+                              AsyncType async_type = AsyncType::ASYNC_SAFE,
+                              size_t timeout_ms = ASYNC_DEFAULT_TIMEOUT,
+                              LogLevel::Level drop_level = LogLevel::Level::WARNING)
+        {
+            assert(!_outputs.empty());
+            _channels.resize(_outputs.size());
+            _channels.back() = ChannelConfig(max_bytes, async_type, timeout_ms, drop_level);
+        }
+        // 最近创建的输出只接收不低于level的日志
+        void buildOutputLevel(LogLevel::Level level)
+        {
+            assert(!_outputs.empty());
+            _outputs.back()->setLevel(level);
+        }
+        // 最近创建的输出使用自己的格式, 模式相同的输出共享格式化结果
+        void buildOutputFormatter(const std::string &pattern)
+        {
+            assert(!_outputs.empty());
+            _outputs.back()->setFormatter(std::make_shared<Formatter>(pattern));
+        }
+        // 为最近创建的输出设置持久化策略, value依次表示毫秒数/字节数/日志等级
+        void buildSyncPolicy(SyncPolicy policy, size_t value)
+        {
+            assert(!_outputs.empty());
+            _outputs.back()->setSyncPolicy(policy, value);
+        }
+        // 最近创建的滚动输出在滚动后于后台压缩旧文件, compressor为空时使用共享的压缩线程
+        void buildCompression(CompressCodec codec, const Compressor::ptr &compressor = Compressor::ptr())
+        {
+            assert(!_outputs.empty());
+            RollingOutput::ptr out = std::dynamic_pointer_cast<RollingOutput>(_outputs.back());
+            assert(out);
+            out->setCompression(codec, compressor);
+        }
+        // 最近创建的滚动输出按照文件数/总字节数/保留时间(秒)在后台删除旧文件, 0表示不限制
+        void buildRetention(size_t max_files, size_t max_bytes = 0, size_t max_age_s = 0,
+                            const Janitor::ptr &janitor = Janitor::ptr())
+        {
+            assert(!_outputs.empty());
+            RollingOutput::ptr out = std::dynamic_pointer_cast<RollingOutput>(_outputs.back());
+            assert(out);
+            out->setRetention(RetentionPolicy(max_files, max_bytes, max_age_s), janitor);
+        }
+        // 最近创建的滚动输出在后台提前打开下一个文件并关闭旧文件, sync_on_close为真时旧文件关闭前同步到磁盘
+        void buildPreopen(bool sync_on_close = false, const RotateWorker::ptr &worker = RotateWorker::ptr())
+        {
+            assert(!_outputs.empty());
+            RollingOutput::ptr out = std::dynamic_pointer_cast<RollingOutput>(_outputs.back());
+            assert(out);
+            out->setPreopen(sync_on_close, worker);
+        }
         virtual Logger::ptr build() = 0;
 
     protected:
@@ -281,6 +944,16 @@ namespace Log
         Formatter::ptr _pfmt;                      // 格式化器
         std::vector<Output::ptr> _outputs;         // 存储输出器
         AsyncType _async_type;                     // 异步日志器类型
+        LooperType _looper_type;                   // 异步缓冲区实现方式
+        size_t _ring_size;                         // 环形缓冲区大小
+        size_t _staging_size;                      // 线程暂存区发布阈值, 0表示不使用暂存区
+        size_t _staging_interval;                  // 线程暂存区超时发布时间(毫秒)
+        bool _deferred;                            // 异步日志器是否延迟格式化
+        size_t _block_timeout;                     // 阻塞等待策略的超时时间(毫秒)
+        LogLevel::Level _drop_level;               // 按等级丢弃策略下保留的最低等级
+        size_t _flush_interval;                    // 异步日志器定时刷新输出的间隔(毫秒)
+        AsyncExecutor::ptr _executor;              // 异步日志器使用的共享执行器, 为空时使用自己的线程
+        std::vector<ChannelConfig> _channels;      // 各输出的独立队列配置, 与_outputs一一对应
     };
 
     class LocalLoggerBuilder : public LoggerBuilder
@@ -302,16 +975,21 @@ namespace Log
             if (_logger_type == ASYNC_LOGGER)
             {
                 // 如果是异步输出
-                return std::make_shared<AsyncLogger>(_logger_name, _limit_level, _pfmt, _outputs, _async_type);
+                return std::make_shared<AsyncLogger>(_logger_name, _limit_level, _pfmt, _outputs, _async_type,
+                                                     _looper_type, _ring_size, _staging_size, _staging_interval, _deferred,
+                                                     _block_timeout, _drop_level, _flush_interval, _executor, _channels);
             }
             return std::make_shared<SyncLogger>(_logger_name, _limit_level, _pfmt, _outputs);
         }
     };
 
     // 日志器管理器, 当没有日志器需要管理时, 创建一个默认的管理器
+    // 查询读取不可变的日志器表快照, 不加锁; 添加日志器时在锁内复制一份新表再原子地替换
+    // 旧表不会立即释放, 其他线程可能仍在读取, 日志器的注册很少, 旧表直到管理器析构时才释放
     class LoggerManager
     {
         const std::string default_logger = "root";
+        using LoggerMap = std::unordered_map<std::string, Logger::ptr>;
 
     public:
         class GC
@@ -319,60 +997,82 @@ namespace Log
         public:
             ~GC()
             {
-                if (LoggerManager::_p_manager)
+                LoggerManager *manager = LoggerManager::_p_manager.exchange(nullptr);
+                if (manager)
                 {
-                    delete LoggerManager::_p_manager;
-                    //_p_manager = nullptr;
+                    delete manager;
                 }
             }
         };
         // 获取管理器实例
         static LoggerManager *getLoggerManager()
         {
-            if (_p_manager == nullptr)
+            LoggerManager *manager = _p_manager.load(std::memory_order_acquire);
+            if (manager == nullptr)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
-                if (_p_manager == nullptr)
+                manager = _p_manager.load(std::memory_order_relaxed);
+                if (manager == nullptr)
                 {
-                    _p_manager = new LoggerManager();
+                    manager = new LoggerManager();
+                    _p_manager.store(manager, std::memory_order_release);
                 }
             }
-            return _p_manager;
+            return manager;
             // static LoggerManager manager;
             // return &manager;
         }
         // 判断是否存在某个日志器
         bool isExists(const std::string &logger_name)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            if (_loggers.count(logger_name))
-                return true;
-            return false;
+            const LoggerMap *loggers = _loggers.load(std::memory_order_acquire);
+            return loggers->count(logger_name) != 0;
         }
         // 添加日志器
         void addLogger(const Logger::ptr &logger)
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            _loggers[logger->loggerName()] = logger;
+            const LoggerMap *old = _loggers.load(std::memory_order_relaxed);
+            LoggerMap *loggers = new LoggerMap(*old);
+            (*loggers)[logger->loggerName()] = logger;
+            // 被替换的日志器仍由旧表持有, 通过裸指针使用它的线程不受影响
+            _retired.emplace_back(old);
+            _loggers.store(loggers, std::memory_order_release);
+            if (logger->loggerName() == default_logger)
+                _root_raw.store(logger.get(), std::memory_order_release);
         }
         // 获取一个日志器
         Logger::ptr getLogger(const std::string &logger_name)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            if (_loggers.count(logger_name) == 0)
+            const LoggerMap *loggers = _loggers.load(std::memory_order_acquire);
+            auto it = loggers->find(logger_name);
+            if (it == loggers->end())
                 return nullptr;
-            return _loggers[logger_name];
+            return it->second;
+        }
+        // 获取日志器的裸指针, 不修改引用计数, 日志器在管理器析构前一直有效
+        Logger *getLoggerRaw(const std::string &logger_name)
+        {
+            const LoggerMap *loggers = _loggers.load(std::memory_order_acquire);
+            auto it = loggers->find(logger_name);
+            if (it == loggers->end())
+                return nullptr;
+            return it->second.get();
         }
         // 获取默认日志器
         Logger::ptr getRootLogger()
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _loggers[default_logger];
+            return getLogger(default_logger);
+        }
+        // 获取默认日志器的裸指针, 不加锁也不修改引用计数, 供日志宏使用
+        Logger *getRootLoggerRaw()
+        {
+            return _root_raw.load(std::memory_order_acquire);
         }
 
         void print()
         {
-            for (auto &it : _loggers)
+            for (auto &it : *_loggers.load(std::memory_order_acquire))
             {
                 std::cout << it.first << ":" << it.second << std::endl;
             }
@@ -385,18 +1085,27 @@ namespace Log
             std::unique_ptr<LocalLoggerBuilder> builder(new LocalLoggerBuilder());
             builder->buildLoggerName(default_logger);
             _root_logger = builder->build();
-            _loggers[_root_logger->loggerName()] = _root_logger;
+            LoggerMap *loggers = new LoggerMap();
+            (*loggers)[_root_logger->loggerName()] = _root_logger;
+            _loggers.store(loggers, std::memory_order_release);
+            _root_raw.store(_root_logger.get(), std::memory_order_release);
+        }
+        ~LoggerManager()
+        {
+            delete _loggers.load(std::memory_order_acquire);
         }
         LoggerManager(const LoggerManager &) = delete;
         LoggerManager operator=(const LoggerManager &) = delete;
 
     private:
-        Logger::ptr _root_logger;                              // 默认日志器
-        std::unordered_map<std::string, Logger::ptr> _loggers; // 日志器管理器
+        Logger::ptr _root_logger;                               // 默认日志器
+        std::atomic<const LoggerMap *> _loggers;                // 当前的日志器表
+        std::atomic<Logger *> _root_raw;                        // 当前默认日志器
+        std::vector<std::unique_ptr<const LoggerMap>> _retired; // 被替换的旧表
         static std::mutex _mutex;
-        static LoggerManager *_p_manager;
+        static std::atomic<LoggerManager *> _p_manager;
     };
-    LoggerManager *LoggerManager::_p_manager = nullptr;
+    std::atomic<LoggerManager *> LoggerManager::_p_manager(nullptr);
     std::mutex LoggerManager::_mutex;
     LoggerManager::GC gc;
 
@@ -421,7 +1130,9 @@ namespace Log
             if (_logger_type == ASYNC_LOGGER)
             {
                 // 如果是异步输出
-                ret = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _pfmt, _outputs, _async_type);
+                ret = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _pfmt, _outputs, _async_type,
+                                                    _looper_type, _ring_size, _staging_size, _staging_interval, _deferred,
+                                                    _block_timeout, _drop_level, _flush_interval, _executor, _channels);
             }
             else
             {
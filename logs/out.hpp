@@ -1,21 +1,168 @@
 #pragma once
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <fstream>
 #include <sstream>
 #include "util.hpp"
+#include "level.hpp"
+#include "buffer.hpp"
+#include "formatter.hpp"
+#include "file.hpp"
+#include "compress.hpp"
+#include "retention.hpp"
+#include "rotate.hpp"
+#ifdef LOG_WITH_URING
+#include <liburing.h>
+#endif
 
 namespace Log
 {
+    // 持久化策略: 决定写入线程什么时候把输出的数据同步到磁盘
+    enum SyncPolicy
+    {
+        SYNC_NONE,     // 不主动同步, 由操作系统决定何时写回
+        SYNC_INTERVAL, // 距离上次同步超过指定的毫秒数
+        SYNC_BYTES,    // 上次同步之后写入的数据超过指定的字节数
+        SYNC_LEVEL,    // 写入了不低于指定等级的日志
+    };
+
     // 基类输出, 提供一个log接口用来进行数据向指定方向的输出
     class Output
     {
     public:
         using ptr = std::shared_ptr<Output>;
-        Output() {}
+        Output()
+            : _level(LogLevel::Level::UNKNOW),
+              _policy(SyncPolicy::SYNC_NONE), _policy_value(0), _unsynced(0),
+              _last_sync(std::chrono::steady_clock::now()),
+              _sync_count(0), _sync_total_us(0), _sync_max_us(0) {}
         virtual ~Output() {}
         virtual void log(const char *data, size_t len) = 0;
+        // 依次输出缓冲区中的多个数据段, 支持聚集写的输出可以重写为一次系统调用
+        virtual void logv(const struct iovec *iov, size_t cnt)
+        {
+            for (size_t i = 0; i < cnt; ++i)
+                log(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+        }
+        // 将输出自己缓冲的数据交给操作系统, 刷新之后其他进程就可以读到
+        virtual void flush() {}
+        // 将已经写入的数据同步到磁盘, 不支持的输出返回false
+        virtual bool sync()
+        {
+            return false;
+        }
+        // 进程崩溃时由信号处理函数调用, 只能使用异步信号安全的调用, 不支持的输出返回false
+        virtual bool crashWrite(const char *, size_t)
+        {
+            return false;
+        }
+
+        // 输出自己的最低等级和格式化器, 格式化器为空时使用日志器的格式化器, 需要在创建日志器前设置
+        void setLevel(LogLevel::Level level)
+        {
+            _level = level;
+        }
+        LogLevel::Level level()
+        {
+            return _level;
+        }
+        void setFormatter(const Formatter::ptr &pfmt)
+        {
+            _pfmt = pfmt;
+        }
+        const Formatter::ptr &formatter()
+        {
+            return _pfmt;
+        }
+
+        // 设置持久化策略, value依次表示毫秒数/字节数/日志等级, 需要在开始写入前设置
+        void setSyncPolicy(SyncPolicy policy, size_t value)
+        {
+            _policy = policy;
+            _policy_value = value;
+        }
+        // SYNC_INTERVAL策略的同步间隔, 其他策略返回0
+        size_t syncInterval()
+        {
+            return _policy == SyncPolicy::SYNC_INTERVAL ? _policy_value : 0;
+        }
+        // 一批数据写入完成后由写入线程调用, bytes和level是这一批的字节数和最高等级
+        // 同一批数据最多同步一次, 异步日志器中一批的所有日志由一次fsync提交
+        void commit(size_t bytes, LogLevel::Level level)
+        {
+            if (_policy == SyncPolicy::SYNC_NONE)
+                return;
+            _unsynced += bytes;
+            if (_unsynced == 0)
+                return; // 上次同步之后没有写入新的数据
+            bool need = false;
+            switch (_policy)
+            {
+            case SyncPolicy::SYNC_INTERVAL:
+                need = std::chrono::steady_clock::now() - _last_sync >= std::chrono::milliseconds(_policy_value);
+                break;
+            case SyncPolicy::SYNC_BYTES:
+                need = _unsynced >= _policy_value;
+                break;
+            case SyncPolicy::SYNC_LEVEL:
+                need = (size_t)level >= _policy_value;
+                break;
+            default:
+                break;
+            }
+            if (need)
+                syncNow();
+        }
+        // 累计同步次数, 同步的平均耗时和最大耗时(微秒)
+        size_t syncCount()
+        {
+            return _sync_count.load(std::memory_order_relaxed);
+        }
+        size_t syncAvgUs()
+        {
+            size_t cnt = syncCount();
+            return cnt == 0 ? 0 : _sync_total_us.load(std::memory_order_relaxed) / cnt;
+        }
+        size_t syncMaxUs()
+        {
+            return _sync_max_us.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void syncNow()
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!sync())
+            {
+                std::cout << "同步到磁盘失败" << std::endl;
+            }
+            _last_sync = std::chrono::steady_clock::now();
+            _unsynced = 0;
+            size_t us = std::chrono::duration_cast<std::chrono::microseconds>(_last_sync - start).count();
+            // 统计只由写入线程更新, 其他线程只读取
+            _sync_count.fetch_add(1, std::memory_order_relaxed);
+            _sync_total_us.fetch_add(us, std::memory_order_relaxed);
+            if (us > _sync_max_us.load(std::memory_order_relaxed))
+                _sync_max_us.store(us, std::memory_order_relaxed);
+        }
+
+    private:
+        LogLevel::Level _level;                           // 输出的最低等级
+        Formatter::ptr _pfmt;                             // 输出自己的格式化器, 为空时使用日志器的
+        SyncPolicy _policy;                               // 持久化策略
+        size_t _policy_value;                             // 策略的参数
+        size_t _unsynced;                                 // 上次同步之后写入的字节数
+        std::chrono::steady_clock::time_point _last_sync; // 上次同步的时间
+        std::atomic<size_t> _sync_count;                  // 同步次数
+        std::atomic<size_t> _sync_total_us;               // 同步的总耗时
+        std::atomic<size_t> _sync_max_us;                 // 同步的最大耗时
     };
     // 标准输出
     class StdOutput : public Output
@@ -27,90 +174,610 @@ namespace Log
         {
             std::cout.write(data, len);
         }
+        void flush()
+        {
+            std::cout.flush();
+        }
+        bool crashWrite(const char *data, size_t len)
+        {
+            return LogFile::writeAll(STDOUT_FILENO, data, len);
+        }
     };
-    // 向文件流中输出
+    // 向文件中输出, backend决定文件的写入方式
     class FileOutput : public Output
     {
     public:
         using ptr = std::shared_ptr<FileOutput>;
-        FileOutput(const std::string &pathname)
+        // prealloc_size为FILE_FD预分配磁盘空间的粒度
+        FileOutput(const std::string &pathname, FileBackend backend = FileBackend::FILE_STREAM, size_t prealloc_size = 0)
             : _pathname(pathname)
         {
             // 如果路径不存在就创建路径, 然后打开文件
             Util::File::create_directory(Util::File::path(_pathname));
-            _ofs.open(_pathname, std::ios::app | std::ios::binary);
-            assert(_ofs.is_open());
+            _file = LogFileFactory::create(_pathname, backend, prealloc_size);
         }
 
         void log(const char *data, size_t len)
         {
-            // std::cout << "data = " << data;
-            //  std::cout << "len = " << len << std::endl;
-            _ofs.write(data, len);
-            if (!_ofs.good())
+            if (!_file->write(data, len))
+            {
+                std::cout << "文件输出失败" << std::endl;
+            }
+        }
+        void logv(const struct iovec *iov, size_t cnt)
+        {
+            if (!_file->writev(iov, cnt))
             {
                 std::cout << "文件输出失败" << std::endl;
             }
         }
 
+        void flush()
+        {
+            _file->flush();
+        }
+        bool sync()
+        {
+            return _file->sync();
+        }
+        bool crashWrite(const char *data, size_t len)
+        {
+            return _file->crashWrite(data, len);
+        }
+
     private:
         std::string _pathname;
-        std::ofstream _ofs;
+        LogFile::ptr _file;
     };
-    // 滚动文件输出, 根据文件大小进行滚动
-    class RollOutput : public Output
+    // 通过内存映射写入文件, 每条日志只是一次内存拷贝, 进程被杀死或崩溃时已写入的数据不会丢失
+    class MmapOutput : public FileOutput
     {
     public:
-        using ptr = std::shared_ptr<RollOutput>;
-        RollOutput(const std::string &basename, size_t max_size)
-            : _basename(basename), _max_size(max_size), _cur_size(0)
+        using ptr = std::shared_ptr<MmapOutput>;
+        MmapOutput(const std::string &pathname)
+            : FileOutput(pathname, FileBackend::FILE_MMAP)
+        {
+        }
+    };
+    // 直接通过文件描述符追加写入文件, 即使用FILE_FD的文件输出, prealloc_size不为0时按该粒度预分配磁盘空间
+    class FdOutput : public FileOutput
+    {
+    public:
+        using ptr = std::shared_ptr<FdOutput>;
+        FdOutput(const std::string &pathname, size_t prealloc_size = 0)
+            : FileOutput(pathname, FileBackend::FILE_FD, prealloc_size)
         {
+        }
+    };
+// io_uring输出同时在途的写入请求数
+#define URING_DEFAULT_DEPTH 4
+#ifdef LOG_WITH_URING
+    // 通过io_uring提交写入, 异步线程提交后立即返回继续格式化下一批数据, 磁盘IO与格式化重叠进行
+    // 调用者的缓冲区在返回后就会被重置, 因此数据先拷贝到在途槽位自己的缓冲区中, 槽位在写入完成后才被复用
+    // 多个请求同时在途时完成顺序不确定, 所以不使用O_APPEND, 而是为每个请求指定文件偏移
+    // 内核不支持io_uring(或被禁用)时退化为FdOutput, 运行中提交失败后也永久退化为FdOutput
+    class UringOutput : public Output
+    {
+        struct Slot
+        {
+            Buffer _buff;                   // 在途的数据
+            std::vector<struct iovec> _iov; // 提交给内核的数据段
+            size_t _offset;                 // 写入的文件偏移
+            size_t _len;                    // 写入的字节数
+            bool _busy;                     // 是否在途
+        };
+        static const size_t MAX_SEGMENTS = 64; // 单个请求最多携带的数据段
+
+    public:
+        using ptr = std::shared_ptr<UringOutput>;
+        UringOutput(const std::string &pathname, size_t depth = URING_DEFAULT_DEPTH, size_t prealloc_size = 0)
+            : _pathname(pathname), _fd(-1), _offset(0), _inflight(0), _next(0)
+        {
+            if (depth == 0)
+                depth = 1;
+            if (io_uring_queue_init(depth, &_ring, 0) != 0)
+            {
+                _fallback = std::make_shared<FdOutput>(pathname, prealloc_size);
+                return;
+            }
             // 如果路径不存在就创建路径, 然后打开文件
-            Util::File::create_directory(Util::File::path(basename));
+            Util::File::create_directory(Util::File::path(_pathname));
+            _fd = open(_pathname.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            assert(_fd >= 0);
+            struct stat st;
+            if (fstat(_fd, &st) == 0)
+                _offset = st.st_size;
+            if (prealloc_size > 0)
+                fallocate(_fd, FALLOC_FL_KEEP_SIZE, _offset, prealloc_size);
+            for (size_t i = 0; i < depth; ++i)
+            {
+                _slots.emplace_back(new Slot());
+                _slots.back()->_busy = false;
+            }
+        }
+        ~UringOutput()
+        {
+            if (_fallback)
+                return;
+            // 等待所有在途的写入完成
+            while (_inflight > 0)
+                reap(true);
+            io_uring_queue_exit(&_ring);
+            close(_fd);
         }
 
         void log(const char *data, size_t len)
         {
-            if (!_ofs.is_open() || _cur_size > _max_size)
+            struct iovec iov;
+            iov.iov_base = const_cast<char *>(data);
+            iov.iov_len = len;
+            logv(&iov, 1);
+        }
+        void logv(const struct iovec *iov, size_t cnt)
+        {
+            for (size_t i = 0; i < cnt; i += MAX_SEGMENTS)
             {
-                // 当前没有文件打开或大小超出限制时, 打开/切换文件
-                _ofs.close();
-                std::string name = createNewFileName();
-                _ofs.open(name, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
-                _cur_size = 0;
+                // 提交失败后剩余的数据段改为同步写入
+                if (_fallback)
+                    _fallback->logv(iov + i, std::min(cnt - i, MAX_SEGMENTS));
+                else
+                    submit(iov + i, std::min(cnt - i, MAX_SEGMENTS));
+            }
+            // 顺便回收已经完成的请求, 不等待
+            while (!_fallback && _inflight > 0 && reap(false))
+                ;
+        }
+        // 等待所有在途的写入完成
+        void flush()
+        {
+            if (_fallback)
+                return _fallback->flush();
+            while (_inflight > 0)
+                reap(true);
+        }
+        bool sync()
+        {
+            if (_fallback)
+                return _fallback->sync();
+            while (_inflight > 0)
+                reap(true);
+            return fdatasync(_fd) == 0;
+        }
+        // 在途的请求由内核继续完成, 崩溃时的数据直接写到它们之后
+        bool crashWrite(const char *data, size_t len)
+        {
+            if (_fallback)
+                return _fallback->crashWrite(data, len);
+            while (len > 0)
+            {
+                ssize_t n = pwrite(_fd, data, len, _offset);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                data += n;
+                len -= n;
+                _offset += n;
+            }
+            return true;
+        }
+
+    private:
+        void submit(const struct iovec *iov, size_t cnt)
+        {
+            Slot &slot = idleSlot();
+            slot._buff.reset();
+            for (size_t i = 0; i < cnt; ++i)
+                slot._buff.push(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+            if (slot._buff.empty())
+                return;
+            slot._iov.clear();
+            slot._buff.segments(slot._iov);
+            slot._offset = _offset;
+            slot._len = slot._buff.readableSize();
+            _offset += slot._len;
+            // 每个槽位最多占用一个提交项, 槽位数等于队列深度, 因此一定能取到提交项
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&_ring);
+            io_uring_prep_writev(sqe, _fd, slot._iov.data(), (unsigned)slot._iov.size(), slot._offset);
+            io_uring_sqe_set_data(sqe, &slot);
+            slot._busy = true;
+            ++_inflight;
+            int ret = io_uring_submit(&_ring);
+            if (ret < 0)
+            {
+                std::cout << "io_uring提交失败, 改为同步写入: " << strerror(-ret) << std::endl;
+                degrade(slot);
+            }
+        }
+        // 提交失败的请求依然留在提交队列中, 之后任何一次提交都会把它交给内核, 而它的槽位可能已经被复用
+        // 因此不再提交任何请求: 同步写入这个槽位的数据, 等待其余在途的请求完成后关闭队列, 之后使用FdOutput
+        // 等待完成事件不会提交队列中的请求
+        void degrade(Slot &failed)
+        {
+            finish(failed, 0);
+            while (_inflight > 0)
+                reap(true);
+            io_uring_queue_exit(&_ring);
+            close(_fd);
+            // 之前的写入都已完成, 文件末尾就是_offset, 以O_APPEND打开后接着写入
+            _fallback = std::make_shared<FdOutput>(_pathname);
+        }
+
+        // 按顺序取下一个槽位, 还在途时等待它完成
+        Slot &idleSlot()
+        {
+            Slot &slot = *_slots[_next];
+            _next = (_next + 1) % _slots.size();
+            while (slot._busy)
+                reap(true);
+            return slot;
+        }
+
+        // 处理一个完成事件, wait为假且没有完成事件时返回false
+        bool reap(bool wait)
+        {
+            struct io_uring_cqe *cqe = nullptr;
+            int ret = wait ? io_uring_wait_cqe(&_ring, &cqe) : io_uring_peek_cqe(&_ring, &cqe);
+            if (ret == -EINTR)
+                return true;
+            if (ret != 0 || cqe == nullptr)
+                return false;
+            Slot *slot = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(&_ring, cqe);
+            if (res < 0 && res != -EINTR && res != -EAGAIN)
+            {
+                std::cout << "文件输出失败: " << strerror(-res) << std::endl;
+                res = (int)slot->_len; // 写入出错时不再重试
             }
-            _ofs.write(data, len);
-            if (!_ofs.good())
+            finish(*slot, res < 0 ? 0 : (size_t)res);
+            return true;
+        }
+
+        // 请求完成, 只写入了一部分时同步写入剩余的部分
+        void finish(Slot &slot, size_t written)
+        {
+            size_t skip = written;
+            bool ok = true;
+            for (size_t i = 0; ok && i < slot._iov.size(); ++i)
+            {
+                const struct iovec &seg = slot._iov[i];
+                if (skip >= seg.iov_len)
+                {
+                    skip -= seg.iov_len;
+                    continue;
+                }
+                const char *data = static_cast<const char *>(seg.iov_base) + skip;
+                size_t len = seg.iov_len - skip;
+                skip = 0;
+                while (len > 0)
+                {
+                    ssize_t n = pwrite(_fd, data, len, slot._offset + written);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n <= 0)
+                    {
+                        std::cout << "文件输出失败: " << strerror(errno) << std::endl;
+                        ok = false;
+                        break;
+                    }
+                    data += n;
+                    len -= n;
+                    written += n;
+                }
+            }
+            slot._busy = false;
+            --_inflight;
+        }
+
+    private:
+        std::string _pathname;
+        int _fd;
+        struct io_uring _ring;
+        std::vector<std::unique_ptr<Slot>> _slots; // 在途槽位, 按顺序轮流使用
+        size_t _offset;                            // 下一次写入的文件偏移
+        size_t _inflight;                          // 在途的请求数
+        size_t _next;                              // 下一个使用的槽位
+        FdOutput::ptr _fallback;                   // 不支持io_uring或提交失败后使用的输出
+    };
+#else
+    // 编译时没有liburing(未定义LOG_WITH_URING)时, io_uring输出就是FdOutput
+    class UringOutput : public FdOutput
+    {
+    public:
+        using ptr = std::shared_ptr<UringOutput>;
+        UringOutput(const std::string &pathname, size_t depth = URING_DEFAULT_DEPTH, size_t prealloc_size = 0)
+            : FdOutput(pathname, prealloc_size)
+        {
+            (void)depth;
+        }
+    };
+#endif
+    // 滚动输出的公共部分, 负责切换文件以及切换之后对旧文件的处理
+    class RollingOutput : public Output
+    {
+    public:
+        using ptr = std::shared_ptr<RollingOutput>;
+        // 根据基础文件名, 文件对应的时间和输出内的序号生成文件名, 可能在后台线程中调用
+        using Namer = std::string (*)(const std::string &basename, time_t t, size_t seq);
+        RollingOutput(const std::string &basename, FileBackend backend, Namer namer)
+            : _basename(basename), _backend(backend), _namer(namer), _seq(0),
+              _codec(CompressCodec::CODEC_NONE),
+              _sync_on_close(false), _next_key(0), _next_t(0),
+              _pending(0), _preparing(false), _prepared_key(0)
+        {
+            // 如果路径不存在就创建路径
+            Util::File::create_directory(Util::File::path(basename));
+        }
+        ~RollingOutput()
+        {
+            if (_worker)
+            {
+                // 等待后台任务结束, 提前打开但没有用到的文件直接关闭
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                _prep_cond.wait(lock, [&]
+                                { return _pending == 0; });
+                if (_prepared)
+                    discard(_prepared, _prepared_name);
+            }
+            if (_retention)
+                _janitor->untrack(_retention);
+        }
+
+        void flush()
+        {
+            if (_file)
+                _file->flush();
+            // 等待后台关闭的旧文件写完, 保证刷新之前写入的数据都已经交给操作系统
+            if (_worker)
+            {
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                _prep_cond.wait(lock, [&]
+                                { return _pending == 0; });
+            }
+        }
+        bool sync()
+        {
+            return !_file || _file->sync();
+        }
+        bool crashWrite(const char *data, size_t len)
+        {
+            return _file && _file->crashWrite(data, len);
+        }
+
+        // 滚动之后在后台压缩旧文件, compressor为空时使用所有输出共享的压缩线程, 需要在开始写入前设置
+        void setCompression(CompressCodec codec, const Compressor::ptr &compressor = Compressor::ptr())
+        {
+            _codec = Codec::resolve(codec);
+            _compressor = compressor ? compressor : Compressor::instance();
+        }
+        // 按照保留策略在后台删除最旧的文件, janitor为空时使用共享的清理线程, 需要在开始写入前设置
+        void setRetention(const RetentionPolicy &policy, const Janitor::ptr &janitor = Janitor::ptr())
+        {
+            // 按时间滚动的输出在构造时就已经打开了文件, 也可能已经在后台准备下一个文件
+            std::unique_lock<std::mutex> lock(_prep_mutex);
+            _janitor = janitor ? janitor : Janitor::instance();
+            _retention = _janitor->track(_basename, policy, _file ? _filename : std::string(),
+                                         _prepared ? _prepared_name : std::string());
+        }
+        // 在后台提前打开下一个文件并关闭旧文件, 滚动时只需要替换文件; sync_on_close为真时旧文件关闭前同步到磁盘
+        // worker为空时使用所有输出共享的后台线程, 需要在开始写入前设置
+        void setPreopen(bool sync_on_close = false, const RotateWorker::ptr &worker = RotateWorker::ptr())
+        {
+            _sync_on_close = sync_on_close;
+            _worker = worker ? worker : RotateWorker::instance();
+            if (_file)
+                prepare();
+        }
+
+    protected:
+        // 切换到时间段key对应的文件: 提前打开的文件属于同一个时间段时直接换上, 否则以时间t命名并在当前线程打开
+        // next_key和next_t是再下一个文件的时间段和命名时间, next_t为0表示使用打开文件时的时间
+        void rotate(time_t key, time_t t, time_t next_key, time_t next_t)
+        {
+            LogFile::ptr old;
+            old.swap(_file);
+            std::string closed;
+            closed.swap(_filename);
+            if (_worker)
+                takePrepared(key);
+            if (!_file)
+            {
+                // 没有提前打开的文件, 不使用后台线程时保持先关闭旧文件再打开新文件的顺序
+                if (!_worker)
+                    retire(old, closed);
+                _filename = _namer(_basename, t, _seq++);
+                _file = LogFileFactory::create(_filename, _backend);
+            }
+            if (_retention)
+                _janitor->opened(_retention, _filename);
+            retire(old, closed);
+            _next_key = next_key;
+            _next_t = next_t;
+            if (_worker)
+                prepare();
+        }
+        void write(const char *data, size_t len)
+        {
+            if (!_file->write(data, len))
             {
                 std::cout << "写入滚动文件失败" << std::endl;
             }
+        }
+
+    private:
+        // 关闭旧文件, 之后交给清理线程和压缩线程, 设置了后台线程时这些都在后台完成
+        void retire(LogFile::ptr &old, const std::string &closed)
+        {
+            if (!old)
+                return;
+            if (!_worker)
+            {
+                finish(old, closed);
+                return;
+            }
+            LogFile::ptr file;
+            file.swap(old);
+            background([this, file, closed]() mutable
+                       { finish(file, closed); });
+        }
+        // 压缩线程和清理线程都要在文件关闭之后才能处理它, 清理线程先记录文件, 压缩完成后再更新文件名
+        void finish(LogFile::ptr &file, const std::string &closed)
+        {
+            if (_sync_on_close && !file->sync())
+            {
+                std::cout << "同步滚动文件失败" << std::endl;
+            }
+            file.reset();
+            bool compress = _codec != CompressCodec::CODEC_NONE;
+            if (_retention)
+                _janitor->closed(_retention, closed, compress);
+            if (!compress)
+                return;
+            Compressor::Callback done;
+            if (_retention)
+            {
+                Janitor::ptr janitor = _janitor;
+                RetentionSet::ptr set = _retention;
+                done = [janitor, set](const std::string &from, const std::string &to, bool ok)
+                { janitor->compressed(set, from, to, ok); };
+            }
+            _compressor->submit(closed, _codec, done);
+        }
+
+        // 在后台打开下一个文件, 已经有准备好或正在准备的文件时不再重复
+        void prepare()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                if (_preparing)
+                    return;
+                _preparing = true;
+            }
+            time_t key = _next_key, t = _next_t;
+            size_t seq = _seq++;
+            background([this, key, t, seq]
+                       {
+                std::string name = _namer(_basename, t == 0 ? time(nullptr) : t, seq);
+                LogFile::ptr file = LogFileFactory::create(name, _backend);
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                if (_retention)
+                    _janitor->prepared(_retention, name);
+                _prepared = file;
+                _prepared_name = name;
+                _prepared_key = key; });
+        }
+        // 换上提前打开的文件, 文件属于已经过去的时间段时(例如中间有一段时间没有日志)在后台删除
+        void takePrepared(time_t key)
+        {
+            std::unique_lock<std::mutex> lock(_prep_mutex);
+            if (!_prepared)
+                return; // 还没有准备好, 由当前线程自己打开
+            _preparing = false;
+            if (_prepared_key == key)
+            {
+                _file.swap(_prepared);
+                _filename.swap(_prepared_name);
+                return;
+            }
+            LogFile::ptr stale;
+            stale.swap(_prepared);
+            std::string name;
+            name.swap(_prepared_name);
+            lock.unlock();
+            background([stale, name]() mutable
+                       { discard(stale, name); });
+        }
+        // 关闭没有用到的文件, 文件中没有数据时删除
+        static void discard(LogFile::ptr &file, const std::string &name)
+        {
+            file.reset();
+            struct stat st;
+            if (::stat(name.c_str(), &st) == 0 && st.st_size == 0)
+                ::unlink(name.c_str());
+        }
+        // 在后台线程中执行任务, 析构和刷新时等待所有任务完成
+        void background(const RotateWorker::Task &task)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                ++_pending;
+            }
+            _worker->post([this, task]
+                          {
+                task();
+                std::unique_lock<std::mutex> lock(_prep_mutex);
+                --_pending;
+                _prep_cond.notify_all(); });
+        }
+
+    protected:
+        std::string _basename;
+        FileBackend _backend;               // 文件的写入方式
+        LogFile::ptr _file;
+        std::string _filename;              // 当前文件名
+
+    private:
+        Namer _namer;                       // 生成文件名
+        size_t _seq;                        // 防止在一秒内创建了相同的文件
+        CompressCodec _codec;               // 旧文件的压缩方式
+        Compressor::ptr _compressor;        // 执行压缩的后台线程
+        Janitor::ptr _janitor;              // 执行清理的后台线程
+        RetentionSet::ptr _retention;       // 保留策略跟踪的文件, 为空表示不清理
+        RotateWorker::ptr _worker;          // 提前打开和关闭文件的后台线程, 为空表示在写入线程中完成
+        bool _sync_on_close;                // 旧文件关闭前是否同步到磁盘
+        time_t _next_key;                   // 下一个文件的时间段
+        time_t _next_t;                     // 下一个文件的命名时间
+        std::mutex _prep_mutex;             // 保护以下成员
+        std::condition_variable _prep_cond; // 等待后台任务完成
+        size_t _pending;                    // 还没有完成的后台任务数
+        bool _preparing;                    // 是否有正在准备或已经准备好的文件
+        LogFile::ptr _prepared;             // 提前打开的文件
+        std::string _prepared_name;         // 提前打开的文件名
+        time_t _prepared_key;               // 提前打开的文件所属的时间段
+    };
+
+    // 滚动文件输出, 根据文件大小进行滚动
+    class RollOutput : public RollingOutput
+    {
+    public:
+        using ptr = std::shared_ptr<RollOutput>;
+        RollOutput(const std::string &basename, size_t max_size, FileBackend backend = FileBackend::FILE_STREAM)
+            : RollingOutput(basename, backend, createNewFileName), _cur_size(0), _max_size(max_size)
+        {
+        }
+
+        void log(const char *data, size_t len)
+        {
+            if (!_file || _cur_size > _max_size)
+            {
+                // 当前没有文件打开或大小超出限制时, 打开/切换文件, 按大小滚动的文件都以打开时的时间命名
+                rotate(0, time(nullptr), 0, 0);
+                _cur_size = 0;
+            }
+            write(data, len);
             _cur_size += len;
         }
 
     private:
-        std::string createNewFileName()
+        static std::string createNewFileName(const std::string &basename, time_t t, size_t seq)
         {
-            time_t t = time(nullptr);
             struct tm s_t;
             localtime_r(&t, &s_t);
             std::stringstream ss;
-            ss << _basename;
+            ss << basename;
             ss << s_t.tm_year + 1900;
             ss << s_t.tm_mon + 1;
             ss << s_t.tm_wday;
             ss << s_t.tm_hour;
             ss << s_t.tm_min;
             ss << s_t.tm_sec;
-            ss << "." << cnt++;
+            ss << "." << seq;
             ss << ".log";
             return ss.str();
         }
 
     private:
-        size_t cnt = 0; // 防止在一秒内创建了相同的文件
-        std::string _basename;
-        std::ofstream _ofs;
         size_t _cur_size; // 当前文件大小
         size_t _max_size; // 文件最大限制
     };
@@ -122,12 +789,12 @@ namespace Log
         Hour,
         Day
     };
-    class TimeRollOutput : public Output
+    class TimeRollOutput : public RollingOutput
     {
     public:
         using ptr = std::shared_ptr<TimeRollOutput>;
-        TimeRollOutput(const std::string &basename, TimeGap gaptype)
-            : _basename(basename)
+        TimeRollOutput(const std::string &basename, TimeGap gaptype, FileBackend backend = FileBackend::FILE_STREAM)
+            : RollingOutput(basename, backend, createNewFileName)
         {
             switch (gaptype)
             {
@@ -145,12 +812,8 @@ namespace Log
                 break;
             }
             // 初始化当前所处的时间段, 如果时间间隔为1, 则每秒都是一个时间段
-            _cur_gap = _gap_size == 1 ? Util::Date::now() : Util::Date::now() / _gap_size;
-            std::string filename = createNewFileName();
-            // 如果路径不存在就创建路径, 然后打开文件
-            Util::File::create_directory(Util::File::path(filename));
-            _ofs.open(filename, std::ios::app);
-            assert(_ofs.is_open());
+            _cur_gap = Util::Date::now() / _gap_size;
+            switchFile();
         }
 
         void log(const char *data, size_t len)
@@ -159,28 +822,25 @@ namespace Log
             time_t cur = Util::Date::now();
             if ((cur / _gap_size) != _cur_gap) // 计算最新的时间段, 如果超过了上次的时间就切换文件
             {
-                _ofs.close();
-                std::string filename = createNewFileName();
-                _ofs.open(filename, std::ios::app);
                 // 更改当前文件的时间段
-                _cur_gap = _gap_size == 1 ? Util::Date::now() : Util::Date::now() / _gap_size;
-                assert(_ofs.is_open());
-            }
-            _ofs.write(data, len);
-            if (!_ofs.good())
-            {
-                std::cout << "写入滚动文件失败" << std::endl;
+                _cur_gap = cur / _gap_size;
+                switchFile();
             }
+            write(data, len);
         }
 
     private:
-        std::string createNewFileName()
+        // 打开当前时间段的文件, 提前打开的下一个文件以下一个时间段的开始时间命名
+        void switchFile()
+        {
+            rotate(_cur_gap, time(nullptr), _cur_gap + 1, (_cur_gap + 1) * _gap_size);
+        }
+        static std::string createNewFileName(const std::string &basename, time_t t, size_t)
         {
-            time_t t = time(nullptr);
             struct tm s_t;
             localtime_r(&t, &s_t);
             std::stringstream ss;
-            ss << _basename;
+            ss << basename;
             ss << s_t.tm_year + 1900;
             ss << s_t.tm_mon + 1;
             ss << s_t.tm_mday;
@@ -192,8 +852,6 @@ namespace Log
         }
 
     private:
-        std::string _basename;
-        std::ofstream _ofs;
         time_t _cur_gap;  // 当前所处的时间段
         time_t _gap_size; // 时间段的大小
     };
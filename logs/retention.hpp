@@ -0,0 +1,331 @@
+#pragma once
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "compress.hpp"
+
+namespace Log
+{
+// 按保留时间清理时检查的间隔(毫秒)
+#define JANITOR_CHECK_INTERVAL 1000
+    // 滚动文件的保留策略, 各项为0表示不限制, 同时设置时任意一项超出都会删除最旧的文件
+    // 只统计已经关闭的旧文件, 正在写入的文件不会被删除
+    struct RetentionPolicy
+    {
+        RetentionPolicy(size_t max_files = 0, size_t max_bytes = 0, size_t max_age_s = 0)
+            : _max_files(max_files), _max_bytes(max_bytes), _max_age_s(max_age_s) {}
+
+        size_t _max_files; // 最多保留的文件数
+        size_t _max_bytes; // 最多占用的字节数
+        size_t _max_age_s; // 最长保留时间(秒), 按文件关闭时的修改时间计算
+    };
+
+    // 一个滚动输出产生的所有文件, 除_active和_next外只由清理线程访问
+    struct RetentionSet
+    {
+        using ptr = std::shared_ptr<RetentionSet>;
+        RetentionSet(const std::string &basename, const RetentionPolicy &policy)
+            : _policy(policy), _total(0)
+        {
+            size_t pos = basename.find_last_of("/\\");
+            _dir = pos == std::string::npos ? "" : basename.substr(0, pos + 1);
+            _prefix = basename.substr(_dir.size());
+        }
+        struct Entry
+        {
+            std::string _name; // 目录中的文件名
+            size_t _size;      // 文件大小
+            int64_t _mtime;    // 文件的修改时间(纳秒), 同一秒内滚动的文件也能区分先后
+        };
+
+        std::string _dir;          // 文件所在的目录, 带有结尾的分隔符
+        std::string _prefix;       // 文件名的前缀
+        RetentionPolicy _policy;   // 保留策略
+        std::deque<Entry> _files;  // 已经关闭的文件, 按修改时间从旧到新
+        size_t _total;             // 已经关闭的文件的总大小
+        std::string _active;       // 正在写入的文件名, 由清理器的锁保护
+        std::string _next;         // 提前打开的下一个文件名, 由清理器的锁保护
+    };
+
+    // 滚动文件的后台清理线程, 所有滚动输出默认共享一个
+    // 登记时扫描一次目录找到之前留下的文件, 之后根据滚动和压缩的通知增量地维护文件列表, 不再重复扫描目录
+    // 所有操作都在低优先级的清理线程中完成, 写入线程只需要把通知放入队列
+    class Janitor
+    {
+    public:
+        using ptr = std::shared_ptr<Janitor>;
+        Janitor()
+            : _stop(false), _busy(false), _deleted_files(0), _deleted_bytes(0)
+        {
+            _thread = std::thread(&Janitor::threadEntry, this);
+            pthread_setname_np(_thread.native_handle(), "log-janitor");
+        }
+        // 处理完队列中剩余的通知后退出
+        ~Janitor()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _thread.join();
+        }
+        static Janitor::ptr instance()
+        {
+            static Janitor::ptr janitor = std::make_shared<Janitor>();
+            return janitor;
+        }
+
+        // 登记basename开头的一组滚动文件, 目录中已有的文件在清理线程中扫描
+        // active和next是登记时已经打开的文件, 在扫描之前记录, 保证它们不会被当作旧文件删除
+        RetentionSet::ptr track(const std::string &basename, const RetentionPolicy &policy,
+                                const std::string &active = std::string(), const std::string &next = std::string())
+        {
+            RetentionSet::ptr set = std::make_shared<RetentionSet>(basename, policy);
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!active.empty())
+                set->_active = leaf(*set, active);
+            if (!next.empty())
+                set->_next = leaf(*set, next);
+            _sets.push_back(set);
+            post(lock, [this, set]
+                 { scan(*set); });
+            return set;
+        }
+        // 滚动输出析构时注销
+        void untrack(const RetentionSet::ptr &set)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _sets.erase(std::remove(_sets.begin(), _sets.end(), set), _sets.end());
+        }
+        // 由写入线程在换上新文件后调用, 正在写入的文件不会被删除
+        void opened(const RetentionSet::ptr &set, const std::string &active)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            set->_active = leaf(*set, active);
+        }
+        // 下一个文件提前打开后调用, 在换上之前同样不会被删除
+        void prepared(const RetentionSet::ptr &set, const std::string &next)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            set->_next = leaf(*set, next);
+        }
+        // 旧文件关闭后调用, pending为真表示它之后会被压缩, 即使压缩先完成了也要记录, 之后由compressed更新
+        void closed(const RetentionSet::ptr &set, const std::string &pathname, bool pending = false)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::string name = leaf(*set, pathname);
+            post(lock, [this, set, name, pending]
+                 { add(*set, name, pending); enforce(*set); });
+        }
+        // 由压缩线程在压缩结束后调用, 成功时原文件已经被压缩后的文件替换
+        void compressed(const RetentionSet::ptr &set, const std::string &from, const std::string &to, bool ok)
+        {
+            if (!ok)
+                return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::string src = leaf(*set, from), dst = leaf(*set, to);
+            post(lock, [this, set, src, dst]
+                 { replace(*set, src, dst); enforce(*set); });
+        }
+        // 等待队列中的通知全部处理完成
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond_idle.wait(lock, [&]
+                            { return _tasks.empty() && !_busy; });
+        }
+        // 累计删除的文件数和字节数
+        size_t deletedFiles()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _deleted_files;
+        }
+        size_t deletedBytes()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _deleted_bytes;
+        }
+
+    private:
+        using Task = std::function<void()>;
+
+        void post(std::unique_lock<std::mutex> &, const Task &task)
+        {
+            _tasks.push_back(task);
+            _cond.notify_all();
+        }
+
+        void threadEntry()
+        {
+            Compressor::lowerPriority();
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                if (_tasks.empty())
+                {
+                    if (_stop)
+                        break;
+                    // 没有通知时定时检查超过保留时间的文件
+                    if (!_cond.wait_for(lock, std::chrono::milliseconds(JANITOR_CHECK_INTERVAL), [&]
+                                        { return _stop || !_tasks.empty(); }))
+                    {
+                        std::vector<RetentionSet::ptr> sets = _sets;
+                        lock.unlock();
+                        for (auto &set : sets)
+                        {
+                            if (set->_policy._max_age_s != 0)
+                                enforce(*set);
+                        }
+                        lock.lock();
+                    }
+                    continue;
+                }
+                Task task = _tasks.front();
+                _tasks.pop_front();
+                _busy = true;
+                lock.unlock();
+                task();
+                lock.lock();
+                _busy = false;
+                if (_tasks.empty())
+                    _cond_idle.notify_all();
+            }
+            _cond_idle.notify_all();
+        }
+
+        // 扫描目录中前缀相同的文件, 只在登记时执行一次
+        void scan(RetentionSet &set)
+        {
+            DIR *dir = opendir(set._dir.empty() ? "." : set._dir.c_str());
+            if (dir == nullptr)
+                return;
+            struct dirent *ent;
+            while ((ent = readdir(dir)) != nullptr)
+            {
+                std::string name = ent->d_name;
+                // 跳过压缩中途留下的临时文件
+                if (name.compare(0, set._prefix.size(), set._prefix) != 0 ||
+                    (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0))
+                    continue;
+                add(set, name);
+            }
+            closedir(dir);
+            enforce(set);
+        }
+        // 按修改时间插入文件, 已经存在或者正在写入的文件不会重复加入
+        void add(RetentionSet &set, const std::string &name, bool pending = false)
+        {
+            if (inUse(set, name))
+                return;
+            for (auto &e : set._files)
+            {
+                if (e._name == name)
+                    return;
+            }
+            struct stat st;
+            RetentionSet::Entry entry{name, 0, nowNs()};
+            if (::stat((set._dir + name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            {
+                entry._size = st.st_size;
+                entry._mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            }
+            else if (!pending)
+                return; // 等待压缩的文件可能已经被压缩结果替换, 大小由compressed更新
+            // 修改时间相同时按加入的顺序排列
+            auto it = std::upper_bound(set._files.begin(), set._files.end(), entry,
+                                       [](const RetentionSet::Entry &a, const RetentionSet::Entry &b)
+                                       { return a._mtime < b._mtime; });
+            set._files.insert(it, entry);
+            set._total += entry._size;
+        }
+        // 文件被压缩后更新文件名和大小, 保留原来的修改时间
+        // 找不到原文件说明它在压缩期间已经被清理, 压缩结果也一并删除
+        void replace(RetentionSet &set, const std::string &from, const std::string &to)
+        {
+            struct stat st;
+            if (::stat((set._dir + to).c_str(), &st) != 0)
+                return;
+            for (auto &e : set._files)
+            {
+                if (e._name == from)
+                {
+                    set._total = set._total - e._size + st.st_size;
+                    e._name = to;
+                    e._size = st.st_size;
+                    return;
+                }
+            }
+            remove(set, to, st.st_size);
+        }
+        // 从最旧的文件开始删除, 直到满足所有限制
+        void enforce(RetentionSet &set)
+        {
+            const RetentionPolicy &policy = set._policy;
+            int64_t now = nowNs();
+            while (!set._files.empty())
+            {
+                const RetentionSet::Entry &oldest = set._files.front();
+                bool over = (policy._max_files != 0 && set._files.size() > policy._max_files) ||
+                            (policy._max_bytes != 0 && set._total > policy._max_bytes) ||
+                            (policy._max_age_s != 0 && oldest._mtime + (int64_t)policy._max_age_s * 1000000000 <= now);
+                if (!over)
+                    break;
+                // 扫描到的旧文件有可能被重新打开继续写入, 这时只停止跟踪
+                if (!inUse(set, oldest._name))
+                    remove(set, oldest._name, oldest._size);
+                set._total -= oldest._size;
+                set._files.pop_front();
+            }
+        }
+        void remove(RetentionSet &set, const std::string &name, size_t size)
+        {
+            if (::unlink((set._dir + name).c_str()) != 0)
+                return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_deleted_files;
+            _deleted_bytes += size;
+        }
+
+        bool inUse(RetentionSet &set, const std::string &name)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return name == set._active || name == set._next;
+        }
+        static int64_t nowNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+        // 去掉路径中的目录部分, 文件名总是以登记时的basename开头
+        static std::string leaf(const RetentionSet &set, const std::string &pathname)
+        {
+            return pathname.substr(std::min(set._dir.size(), pathname.size()));
+        }
+
+    private:
+        bool _stop;
+        bool _busy;                             // 是否正在处理通知
+        std::mutex _mutex;
+        std::condition_variable _cond;          // 清理线程等待新的通知
+        std::condition_variable _cond_idle;     // 等待通知全部处理完成
+        std::deque<Task> _tasks;                // 等待处理的通知
+        std::vector<RetentionSet::ptr> _sets;   // 登记的所有文件组
+        size_t _deleted_files;                  // 累计删除的文件数
+        size_t _deleted_bytes;                  // 累计删除的字节数
+        std::thread _thread;
+    };
+}
\ No newline at end of file
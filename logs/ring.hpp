@@ -0,0 +1,225 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include "buffer.hpp"
+
+namespace Log
+{
+// 环形缓冲区默认大小为1M, 实际容量会向上取整为2的幂
+#define RING_DEFAULT_SIZE (1024 * 1024 * 1)
+    // 多生产者单消费者的无锁环形缓冲区
+    // 每条记录由8字节头部(提交标记|标签|长度)和数据组成, 整体按8字节对齐, 因此头部不会跨越环尾
+    // 生产者: CAS预留空间 -> 拷贝数据 -> release写入头部完成提交
+    // 消费者: acquire读取头部 -> 拷贝数据 -> 清零已读区域 -> 推进读指针
+    class RingBuffer
+    {
+        static const uint64_t COMMIT_FLAG = 1ULL << 63; // 记录已提交
+        static const uint64_t LARGE_FLAG = 1ULL << 62;  // 记录数据存放在环外
+        static const uint64_t LEN_MASK = 0xffffffffULL;
+        static const int TAG_SHIFT = 32; // 头部的32~39位保存写入者给出的标签(日志等级)
+        static const size_t HEADER_SIZE = sizeof(uint64_t);
+
+    public:
+        RingBuffer(size_t capacity = RING_DEFAULT_SIZE)
+            : _head(0), _tail(0)
+        {
+            _capacity = 64;
+            while (_capacity < capacity)
+                _capacity <<= 1;
+            _mask = _capacity - 1;
+            // 使用uint64_t数组保证头部8字节对齐, 初始全部清零表示未提交
+            _words.reset(new uint64_t[_capacity / sizeof(uint64_t)]());
+            _data = reinterpret_cast<char *>(_words.get());
+        }
+
+        // 读写位置按缓存行对齐, C++11的new不保证超过16字节的对齐, 由这里按缓存行分配
+        static void *operator new(size_t size)
+        {
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, 64, size) != 0)
+                throw std::bad_alloc();
+            return ptr;
+        }
+        static void operator delete(void *ptr)
+        {
+            free(ptr);
+        }
+
+        // 尝试写入一条记录, 空间不足时返回false, 由调用者决定等待或丢弃
+        bool tryPush(const char *data, size_t len, uint8_t tag = 0)
+        {
+            uint64_t flags = (uint64_t)tag << TAG_SHIFT;
+            if (len > maxInlineSize())
+            {
+                // 超大记录存放到环外, 环内只保存指针和长度
+                char *large = new char[len];
+                memcpy(large, data, len);
+                uint64_t payload[2] = {(uint64_t)(uintptr_t)large, (uint64_t)len};
+                if (!reserveAndCommit(reinterpret_cast<const char *>(payload), sizeof(payload), flags | LARGE_FLAG))
+                {
+                    delete[] large;
+                    return false;
+                }
+                return true;
+            }
+            return reserveAndCommit(data, len, flags);
+        }
+
+        // 将所有已提交的记录依次拷贝到buff中, 返回拷贝的字节数, 只能由消费者线程调用
+        // max_tag不为空时保存这些记录中最大的标签
+        size_t popTo(Buffer &buff, uint8_t *max_tag = nullptr)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            size_t total = 0;
+            while (true)
+            {
+                uint64_t *hdr = header(head);
+                uint64_t h = __atomic_load_n(hdr, __ATOMIC_ACQUIRE);
+                if (!(h & COMMIT_FLAG))
+                    break; // 下一条记录还未提交
+                size_t len = (size_t)(h & LEN_MASK);
+                size_t need = recordSize(len);
+                if (max_tag != nullptr)
+                    *max_tag = std::max(*max_tag, (uint8_t)(h >> TAG_SHIFT));
+                if (h & LARGE_FLAG)
+                {
+                    uint64_t payload[2];
+                    copyOut(head + HEADER_SIZE, reinterpret_cast<char *>(payload), sizeof(payload));
+                    char *large = reinterpret_cast<char *>((uintptr_t)payload[0]);
+                    buff.push(large, (size_t)payload[1]);
+                    total += (size_t)payload[1];
+                    delete[] large;
+                }
+                else
+                {
+                    // 跨越环尾的记录也要连续地写入buff, 保证记录不会被拆到两个块中
+                    buff.reserve(len);
+                    copyOut(head + HEADER_SIZE, buff.writePtr(), len);
+                    buff.moveWriter(len);
+                    total += len;
+                }
+                // 清零已读区域, 保证下一圈未提交的位置读到的头部一定为0
+                clear(head, need);
+                head += need;
+            }
+            _head.store(head, std::memory_order_release);
+            return total;
+        }
+
+        // 不消费地依次对已提交的记录调用f(data, len), 遇到未提交的记录时停止
+        // 只在进程崩溃时使用, 此时消费者可能停在任意位置, 不修改任何状态
+        template <typename F>
+        void forEachCommitted(F &f)
+        {
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            while (head < tail)
+            {
+                uint64_t h = __atomic_load_n(header(head), __ATOMIC_ACQUIRE);
+                if (!(h & COMMIT_FLAG))
+                    break;
+                size_t len = (size_t)(h & LEN_MASK);
+                if (h & LARGE_FLAG)
+                {
+                    uint64_t payload[2];
+                    copyOut(head + HEADER_SIZE, reinterpret_cast<char *>(payload), sizeof(payload));
+                    f(reinterpret_cast<const char *>((uintptr_t)payload[0]), (size_t)payload[1]);
+                }
+                else
+                {
+                    size_t off = (head + HEADER_SIZE) & _mask;
+                    size_t first = std::min(len, _capacity - off);
+                    f(_data + off, first);
+                    if (first < len)
+                        f(_data, len - first);
+                }
+                head += recordSize(len);
+            }
+        }
+
+        // 队首记录是否已提交
+        bool readable()
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            return __atomic_load_n(header(head), __ATOMIC_ACQUIRE) & COMMIT_FLAG;
+        }
+        // 预留位置, 之前预留的记录都会在消费位置越过这里之前被读取
+        uint64_t tail()
+        {
+            return _tail.load(std::memory_order_acquire);
+        }
+        // 消费位置
+        uint64_t head()
+        {
+            return _head.load(std::memory_order_acquire);
+        }
+        // 是否还有被预留的记录(包括尚未提交的)
+        bool empty()
+        {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+        // 可以直接存放在环内的最大记录长度, 超过该长度的记录存放到环外
+        size_t maxInlineSize()
+        {
+            return _capacity / 4;
+        }
+
+    private:
+        bool reserveAndCommit(const char *data, size_t len, uint64_t flags)
+        {
+            size_t need = recordSize(len);
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            do
+            {
+                uint64_t head = _head.load(std::memory_order_acquire);
+                if (tail + need - head > _capacity)
+                    return false; // 空间不足
+            } while (!_tail.compare_exchange_weak(tail, tail + need, std::memory_order_relaxed));
+            copyIn(tail + HEADER_SIZE, data, len);
+            __atomic_store_n(header(tail), COMMIT_FLAG | flags | (uint64_t)len, __ATOMIC_RELEASE);
+            return true;
+        }
+        size_t recordSize(size_t len)
+        {
+            return (HEADER_SIZE + len + 7) & ~(size_t)7;
+        }
+        uint64_t *header(uint64_t pos)
+        {
+            return reinterpret_cast<uint64_t *>(_data + (pos & _mask));
+        }
+        void copyIn(uint64_t pos, const char *data, size_t len)
+        {
+            size_t off = pos & _mask;
+            size_t first = std::min(len, _capacity - off);
+            memcpy(_data + off, data, first);
+            memcpy(_data, data + first, len - first);
+        }
+        void copyOut(uint64_t pos, char *data, size_t len)
+        {
+            size_t off = pos & _mask;
+            size_t first = std::min(len, _capacity - off);
+            memcpy(data, _data + off, first);
+            memcpy(data + first, _data, len - first);
+        }
+        void clear(uint64_t pos, size_t len)
+        {
+            size_t off = pos & _mask;
+            size_t first = std::min(len, _capacity - off);
+            memset(_data + off, 0, first);
+            memset(_data, 0, len - first);
+        }
+
+    private:
+        alignas(64) std::atomic<uint64_t> _head; // 消费位置, 只由消费者修改
+        alignas(64) std::atomic<uint64_t> _tail; // 预留位置, 由生产者通过CAS修改
+        alignas(64) size_t _capacity;
+        size_t _mask;
+        std::unique_ptr<uint64_t[]> _words;
+        char *_data;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+#include <pthread.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace Log
+{
+    // 滚动输出的后台线程: 提前打开下一个文件, 关闭(以及同步)旧文件, 滚动时写入线程只需要替换文件
+    // 使用普通优先级, 保证下一个文件在需要之前已经准备好; 压缩和清理仍然在低优先级的线程中进行
+    class RotateWorker
+    {
+    public:
+        using ptr = std::shared_ptr<RotateWorker>;
+        using Task = std::function<void()>;
+        RotateWorker()
+            : _stop(false)
+        {
+            _thread = std::thread(&RotateWorker::threadEntry, this);
+            pthread_setname_np(_thread.native_handle(), "log-rotate");
+        }
+        // 执行完队列中剩余的任务后退出
+        ~RotateWorker()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _thread.join();
+        }
+        // 所有滚动输出默认共享的后台线程
+        static RotateWorker::ptr instance()
+        {
+            static RotateWorker::ptr worker = std::make_shared<RotateWorker>();
+            return worker;
+        }
+
+        void post(const Task &task)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _tasks.push_back(task);
+            _cond.notify_all();
+        }
+
+    private:
+        void threadEntry()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _cond.wait(lock, [&]
+                           { return _stop || !_tasks.empty(); });
+                if (_tasks.empty())
+                    break;
+                Task task = std::move(_tasks.front());
+                _tasks.pop_front();
+                lock.unlock();
+                task();
+                // 任务中保存的文件等资源在后台线程中释放
+                task = Task();
+                lock.lock();
+            }
+        }
+
+    private:
+        bool _stop;
+        std::mutex _mutex;
+        std::condition_variable _cond; // 后台线程等待新的任务
+        std::deque<Task> _tasks;       // 等待执行的任务
+        std::thread _thread;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "async.hpp"
+
+namespace Log
+{
+// 线程暂存缓冲区的默认发布阈值: 累计64K或最早的数据超过100ms
+#define STAGING_DEFAULT_SIZE (64 * 1024)
+#define STAGING_DEFAULT_INTERVAL 100
+    // 单个线程针对单个日志器的暂存缓冲区
+    // 通常只有所属线程访问, 互斥锁只在日志器析构或消费者收集超时数据时才会产生竞争
+    struct StagingBuffer
+    {
+        using ptr = std::shared_ptr<StagingBuffer>;
+        StagingBuffer(size_t size, const AsyncLooper::ptr &looper)
+            : _buff(size), _first_ms(0), _count(0), _level(LogLevel::Level::UNKNOW), _looper(looper) {}
+
+        std::mutex _mutex;
+        Buffer _buff;                       // 暂存的数据
+        size_t _first_ms;                   // 暂存区中最早数据的写入时间
+        size_t _count;                      // 暂存的日志条数
+        LogLevel::Level _level;             // 暂存日志中的最高等级
+        std::weak_ptr<AsyncLooper> _looper; // 数据最终发布到的异步循环
+    };
+
+    // 每个异步日志器拥有一个暂存区, 生产者线程先写入自己的暂存缓冲区, 达到阈值后整批发布到AsyncLooper
+    // 这样跨核的缓存行竞争只与批次数量相关, 与日志条数无关
+    class StagingArea
+    {
+    public:
+        using ptr = std::shared_ptr<StagingArea>;
+        StagingArea(const AsyncLooper::ptr &looper,
+                    size_t threshold = STAGING_DEFAULT_SIZE,
+                    size_t interval_ms = STAGING_DEFAULT_INTERVAL)
+            : _id(nextId()), _looper(looper), _threshold(threshold), _interval_ms(interval_ms)
+        {
+        }
+
+        // 生产者写入, force为真时立即发布当前线程暂存的所有数据
+        void push(const char *data, size_t len, LogLevel::Level level, bool force)
+        {
+            StagingBuffer::ptr sb = local();
+            std::unique_lock<std::mutex> lock(sb->_mutex);
+            if (len >= _threshold)
+            {
+                // 单条数据超过阈值, 先发布已暂存的数据保证顺序, 再直接写入异步循环
+                publish(*sb);
+                _looper->push(data, len, level);
+                return;
+            }
+            size_t now = nowMs();
+            if (sb->_buff.empty())
+                sb->_first_ms = now;
+            sb->_buff.push(data, len);
+            ++sb->_count;
+            sb->_level = std::max(sb->_level, level);
+            if (force || sb->_buff.readableSize() >= _threshold || now - sb->_first_ms >= _interval_ms)
+                publish(*sb);
+        }
+
+        // 消费者线程调用: 将超过时间阈值的暂存数据发布到异步循环, 在下一批中处理
+        // 所属线程之前发布的数据可能还在生产缓冲区或大记录中, 不能直接放进正在处理的这一批, 否则顺序会颠倒
+        // 使用try_lock, 如果生产者正在写入说明它很快就会自己发布, 不需要等待
+        void collect()
+        {
+            size_t now = nowMs();
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto it = _buffers.begin(); it != _buffers.end();)
+            {
+                // 只剩暂存区自己持有说明所属线程已经退出, 退出时数据已经发布, 直接移除
+                if (it->use_count() == 1)
+                {
+                    it = _buffers.erase(it);
+                    continue;
+                }
+                StagingBuffer::ptr &sb = *it++;
+                std::unique_lock<std::mutex> sb_lock(sb->_mutex, std::try_to_lock);
+                if (!sb_lock.owns_lock() || sb->_buff.empty())
+                    continue;
+                if (now - sb->_first_ms < _interval_ms)
+                    continue;
+                // 环形缓冲区已满时留给所属线程自己发布
+                if (_looper->pushFromConsumer(sb->_buff.begin(), sb->_buff.readableSize(), sb->_level, sb->_count))
+                    reset(*sb);
+            }
+        }
+
+        // 将所有线程暂存的数据发布到异步循环, 在日志器析构前调用
+        void flushAll()
+        {
+            // 发布时可能需要等待消费者, 不能持有_mutex, 否则消费者收集时会与这里互相等待
+            std::vector<StagingBuffer::ptr> buffers;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                buffers = _buffers;
+            }
+            for (auto &sb : buffers)
+            {
+                std::unique_lock<std::mutex> sb_lock(sb->_mutex);
+                publish(*sb);
+            }
+        }
+
+        // 进程崩溃时由信号处理函数调用, 不加锁地对各线程暂存的数据依次调用f(data, len)
+        template <typename F>
+        void drainUnsafe(F &f)
+        {
+            for (auto &sb : _buffers)
+                sb->_buff.forEachSegment(f);
+        }
+
+        size_t interval()
+        {
+            return _interval_ms;
+        }
+
+    private:
+        // 线程退出时, 将该线程所有暂存区中的数据发布出去
+        struct ThreadLocalStaging
+        {
+            std::vector<std::pair<size_t, StagingBuffer::ptr>> _entries;
+            ~ThreadLocalStaging()
+            {
+                for (auto &entry : _entries)
+                {
+                    std::unique_lock<std::mutex> lock(entry.second->_mutex);
+                    publish(*entry.second);
+                }
+            }
+        };
+
+        static void publish(StagingBuffer &sb)
+        {
+            if (sb._buff.empty())
+                return;
+            AsyncLooper::ptr looper = sb._looper.lock();
+            // 整批写入异步循环, 由异步循环按照策略统计丢弃的条数
+            if (looper)
+                looper->push(sb._buff.begin(), sb._buff.readableSize(), sb._level, sb._count);
+            reset(sb);
+        }
+        static void reset(StagingBuffer &sb)
+        {
+            sb._buff.reset();
+            sb._count = 0;
+            sb._level = LogLevel::Level::UNKNOW;
+        }
+
+        // 查找当前线程在本日志器下的暂存缓冲区, 不存在时创建并登记
+        StagingBuffer::ptr local()
+        {
+            static thread_local ThreadLocalStaging tls;
+            for (auto &entry : tls._entries)
+            {
+                if (entry.first == _id)
+                    return entry.second;
+            }
+            // 顺便清理已经销毁的日志器留下的暂存缓冲区
+            for (auto it = tls._entries.begin(); it != tls._entries.end();)
+            {
+                if (it->second->_looper.expired())
+                    it = tls._entries.erase(it);
+                else
+                    ++it;
+            }
+            StagingBuffer::ptr sb = std::make_shared<StagingBuffer>(_threshold * 2, _looper);
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _buffers.push_back(sb);
+            }
+            tls._entries.emplace_back(_id, sb);
+            return sb;
+        }
+
+        static size_t nextId()
+        {
+            static std::atomic<size_t> id(0);
+            return ++id;
+        }
+
+        static size_t nowMs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+
+    private:
+        size_t _id;                               // 区分不同的日志器, 不使用地址防止日志器销毁后地址被复用
+        AsyncLooper::ptr _looper;                 // 数据最终发布到的异步循环
+        size_t _threshold;                        // 按大小发布的阈值
+        size_t _interval_ms;                      // 按时间发布的阈值
+        std::mutex _mutex;                        // 保护_buffers
+        std::vector<StagingBuffer::ptr> _buffers; // 所有线程的暂存缓冲区
+    };
+}
\ No newline at end of file
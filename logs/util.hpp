@@ -1,6 +1,12 @@
 #pragma once
 #include <iostream>
+#include <atomic>
+#include <cstdint>
 #include <ctime>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -16,6 +22,209 @@ namespace Log
             {
                 return (size_t)time(nullptr);
             }
+
+            // 重新解析时区, 时区或夏令时发生变化后需要显式调用
+            static void reloadTimezone()
+            {
+                tzset();
+                time_t t = time(nullptr);
+                struct tm lt;
+                localtime_r(&t, &lt);
+                zoneOffset() = lt.tm_gmtoff;
+                zoneDst() = lt.tm_isdst > 0 ? 1 : 0;
+            }
+
+            // 不加锁的localtime: 使用启动时解析好的时区偏移计算, 避免localtime_r中glibc的时区锁
+            static void localTime(time_t t, struct tm &out)
+            {
+                static std::once_flag once;
+                std::call_once(once, reloadTimezone);
+                long offset = zoneOffset();
+                int dst = zoneDst();
+                long long local = (long long)t + offset;
+                long long days = local / 86400;
+                long long secs = local % 86400;
+                if (secs < 0)
+                {
+                    secs += 86400;
+                    --days;
+                }
+                out.tm_hour = secs / 3600;
+                out.tm_min = secs % 3600 / 60;
+                out.tm_sec = secs % 60;
+                // 1970-01-01是星期四
+                out.tm_wday = (int)(((days % 7) + 11) % 7);
+                int year, month, day;
+                civilFromDays(days, year, month, day);
+                out.tm_year = year - 1900;
+                out.tm_mon = month - 1;
+                out.tm_mday = day;
+                out.tm_yday = (int)(days - daysFromCivil(year, 1, 1));
+                out.tm_isdst = dst;
+                out.tm_gmtoff = offset;
+                out.tm_zone = tzname[dst];
+            }
+
+        private:
+            static std::atomic<long> &zoneOffset()
+            {
+                static std::atomic<long> offset(0);
+                return offset;
+            }
+            static std::atomic<int> &zoneDst()
+            {
+                static std::atomic<int> dst(0);
+                return dst;
+            }
+            // 公历日期与1970-01-01起天数的相互转换
+            static long long daysFromCivil(int y, int m, int d)
+            {
+                y -= m <= 2;
+                long long era = (y >= 0 ? y : y - 399) / 400;
+                unsigned yoe = (unsigned)(y - era * 400);
+                unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+                unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+                return era * 146097 + (long long)doe - 719468;
+            }
+            static void civilFromDays(long long z, int &y, int &m, int &d)
+            {
+                z += 719468;
+                long long era = (z >= 0 ? z : z - 146096) / 146097;
+                unsigned doe = (unsigned)(z - era * 146097);
+                unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+                unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+                unsigned mp = (5 * doy + 2) / 153;
+                d = doy - (153 * mp + 2) / 5 + 1;
+                m = mp < 10 ? mp + 3 : mp - 9;
+                y = (int)(yoe + era * 400) + (m <= 2);
+            }
+        };
+
+        // 日志时间戳的时钟源
+        enum ClockSource
+        {
+            CLOCK_SOURCE_REALTIME,        // CLOCK_REALTIME, 精确的墙上时间
+            CLOCK_SOURCE_REALTIME_COARSE, // CLOCK_REALTIME_COARSE, 精度为一个时钟节拍(通常1~4ms), 开销最小
+            CLOCK_SOURCE_MONOTONIC,       // CLOCK_MONOTONIC, 转换为墙上时间时加上启动时的偏移
+            CLOCK_SOURCE_TSC,             // rdtsc, 按校准结果转换为墙上时间, 非x86平台退化为CLOCK_MONOTONIC
+        };
+
+        // 时间戳分两步获取: 调用线程只读取原始时钟值, 转换为墙上时间的工作可以放到异步线程中完成
+        class Clock
+        {
+        public:
+            // 设置全局使用的时钟源
+            static void setSource(ClockSource src)
+            {
+                if (src == CLOCK_SOURCE_MONOTONIC || src == CLOCK_SOURCE_TSC)
+                    calibrated();
+                source() = src;
+            }
+            static ClockSource getSource()
+            {
+                return source();
+            }
+            // 读取原始时钟值: TSC为时钟周期数, 其余为纳秒
+            static uint64_t tick(ClockSource src)
+            {
+                switch (src)
+                {
+                case CLOCK_SOURCE_REALTIME_COARSE:
+                    return readClock(CLOCK_REALTIME_COARSE);
+                case CLOCK_SOURCE_MONOTONIC:
+                    return readClock(CLOCK_MONOTONIC);
+                case CLOCK_SOURCE_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+                    return __rdtsc();
+#else
+                    return readClock(CLOCK_MONOTONIC);
+#endif
+                default:
+                    return readClock(CLOCK_REALTIME);
+                }
+            }
+            // 将原始时钟值转换为墙上时间(秒 + 秒内纳秒)
+            static void toWall(ClockSource src, uint64_t tick, size_t &sec, size_t &nsec)
+            {
+                int64_t ns = (int64_t)tick;
+                if (src == CLOCK_SOURCE_MONOTONIC)
+                {
+                    ns += calibrated()._mono_to_wall;
+                }
+                else if (src == CLOCK_SOURCE_TSC)
+                {
+#if defined(__x86_64__) || defined(__i386__)
+                    const Calibration &c = calibrated();
+                    ns = c._tsc_wall + (int64_t)((double)(int64_t)(tick - c._tsc_base) * c._ns_per_tick);
+#else
+                    ns += calibrated()._mono_to_wall;
+#endif
+                }
+                sec = ns / 1000000000;
+                nsec = ns % 1000000000;
+            }
+            // 使用当前时钟源获取墙上时间
+            static void now(size_t &sec, size_t &nsec)
+            {
+                ClockSource src = source();
+                toWall(src, tick(src), sec, nsec);
+            }
+            // 重新校准MONOTONIC/TSC与墙上时间的对应关系, 系统时间被调整后可以调用
+            // 校准结果整体替换, 其他线程读取到的总是完整的旧结果或新结果
+            // 旧结果可能仍在被读取, 不释放, 只在系统时间被调整时调用, 泄漏可以忽略
+            static void calibrate()
+            {
+                Calibration *c = new Calibration();
+                uint64_t mono0 = readClock(CLOCK_MONOTONIC);
+                c->_mono_to_wall = (int64_t)readClock(CLOCK_REALTIME) - (int64_t)mono0;
+#if defined(__x86_64__) || defined(__i386__)
+                // 用10ms的MONOTONIC时间测量TSC的频率
+                uint64_t tsc0 = __rdtsc();
+                uint64_t mono1 = mono0;
+                while (mono1 - mono0 < 10000000)
+                    mono1 = readClock(CLOCK_MONOTONIC);
+                uint64_t tsc1 = __rdtsc();
+                c->_ns_per_tick = (double)(mono1 - mono0) / (double)(tsc1 - tsc0);
+                c->_tsc_base = __rdtsc();
+                c->_tsc_wall = (int64_t)readClock(CLOCK_REALTIME);
+#endif
+                calibration().store(c, std::memory_order_release);
+            }
+
+        private:
+            struct Calibration
+            {
+                int64_t _mono_to_wall = 0; // 墙上时间 - MONOTONIC时间
+                uint64_t _tsc_base = 0;    // 校准时的TSC值
+                int64_t _tsc_wall = 0;     // 校准时的墙上时间
+                double _ns_per_tick = 1;   // 每个时钟周期的纳秒数
+            };
+            static uint64_t readClock(clockid_t id)
+            {
+                struct timespec ts;
+                clock_gettime(id, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            }
+            static std::atomic<const Calibration *> &calibration()
+            {
+                static std::atomic<const Calibration *> c(nullptr);
+                return c;
+            }
+            // 第一次使用时校准
+            static const Calibration &calibrated()
+            {
+                const Calibration *c = calibration().load(std::memory_order_acquire);
+                if (c != nullptr)
+                    return *c;
+                static std::once_flag once;
+                std::call_once(once, calibrate);
+                return *calibration().load(std::memory_order_acquire);
+            }
+            static std::atomic<ClockSource> &source()
+            {
+                static std::atomic<ClockSource> src(CLOCK_SOURCE_REALTIME);
+                return src;
+            }
         };
 
         class File
@@ -1,10 +1,12 @@
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <vector>
 #include <string>
 #include "../logs/log.hpp"
 using namespace Log;
-void performanceTest(const std::string &logger_name, size_t thread_cnt, size_t msg_cnt, size_t msg_size)
+// typed为真时使用类型安全的LOG_DEBUG接口, 否则使用printf风格的接口
+void performanceTest(const std::string &logger_name, size_t thread_cnt, size_t msg_cnt, size_t msg_size, bool typed = false)
 {
     std::cout << "日志器名: " << logger_name << std::endl;
     std::cout << "线程个数: " << thread_cnt << std::endl;
@@ -23,7 +25,10 @@ void performanceTest(const std::string &logger_name, size_t thread_cnt, size_t m
             auto start = std::chrono::high_resolution_clock::now();
             for(int j = 0; j < msg_cnt_thread; ++j)
             {
-                logger->debug("%s", msg.c_str());
+                if (typed)
+                    LOG_DEBUG(logger, "{}", msg);
+                else
+                    logger->debug("%s", msg.c_str());
             }
             auto end = std::chrono::high_resolution_clock::now();
             auto time_gap = std::chrono::duration_cast<std::chrono::duration<double>>(end - start);
@@ -72,9 +77,291 @@ void testAsync()
     std::cout << "--------------------------------------------------" << std::endl;
 }
 
+void testLockFreeAsync()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    INFO("%s", "无锁异步日志性能测试");
+    std::string logger_name = "LockFreeAsyncLogger";
+    std::unique_ptr<GlobalLoggerBuilder> builder(new GlobalLoggerBuilder());
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildLockFreeAsync();
+    builder->buildLoggerName(logger_name);
+    builder->buildOutputType<FileOutput>("./fileout/file.log");
+    builder->buildOutputType<RollOutput>("./rollout/roll.log", 1024 * 1024);
+    auto logger = builder->build();
+    performanceTest(logger_name, 5, 2000000, 20);
+    INFO("%s", "无锁异步日志性能测试结束");
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+void testStagingAsync()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    INFO("%s", "线程暂存区异步日志性能测试");
+    std::string logger_name = "StagingAsyncLogger";
+    std::unique_ptr<GlobalLoggerBuilder> builder(new GlobalLoggerBuilder());
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildThreadStaging();
+    builder->buildLoggerName(logger_name);
+    builder->buildOutputType<FileOutput>("./fileout/file.log");
+    builder->buildOutputType<RollOutput>("./rollout/roll.log", 1024 * 1024);
+    auto logger = builder->build();
+    performanceTest(logger_name, 5, 2000000, 20);
+    INFO("%s", "线程暂存区异步日志性能测试结束");
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+void testDeferredAsync()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    INFO("%s", "延迟格式化异步日志性能测试");
+    std::string logger_name = "DeferredAsyncLogger";
+    std::unique_ptr<GlobalLoggerBuilder> builder(new GlobalLoggerBuilder());
+    builder->buildLoggerType(LoggerType::ASYNC_LOGGER);
+    builder->buildDeferredFormat();
+    builder->buildLoggerName(logger_name);
+    builder->buildOutputType<FileOutput>("./fileout/file.log");
+    builder->buildOutputType<RollOutput>("./rollout/roll.log", 1024 * 1024);
+    auto logger = builder->build();
+    performanceTest(logger_name, 5, 2000000, 20);
+    INFO("%s", "延迟格式化异步日志性能测试结束");
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 对比printf风格接口(vasprintf)与类型安全接口(栈上缓冲区)的吞吐量
+void testTypedApi()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    INFO("%s", "printf风格接口与类型安全接口性能对比");
+    std::string logger_name = "TypedApiLogger";
+    std::unique_ptr<GlobalLoggerBuilder> builder(new GlobalLoggerBuilder());
+    builder->buildLoggerType(LoggerType::SYNC_LOGGER);
+    builder->buildLoggerName(logger_name);
+    builder->buildOutputType<FileOutput>("./fileout/file.log");
+    auto logger = builder->build();
+    std::cout << "printf风格接口:" << std::endl;
+    performanceTest(logger_name, 5, 2000000, 20);
+    std::cout << "类型安全接口:" << std::endl;
+    performanceTest(logger_name, 5, 2000000, 20, true);
+    INFO("%s", "printf风格接口与类型安全接口性能对比结束");
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 等级不满足时每次日志调用的开销, 参数的构造不应计入
+void testDisabledLevel()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t cnt = 100000000;
+    std::unique_ptr<LocalLoggerBuilder> builder(new LocalLoggerBuilder());
+    builder->buildLoggerName("DisabledLogger");
+    builder->buildLoggerLevel(LogLevel::Level::INFO);
+    auto logger = builder->build();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < cnt; ++i)
+    {
+        logger->debug("%s-%zu", std::to_string(i).c_str(), i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count() / cnt;
+    std::cout << "关闭的debug日志: " << ns << " ns/条" << std::endl;
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 16个线程同时通过默认日志器的宏和管理器查询日志器, 查询不加锁, 线程之间不会在管理器上串行化
+void testManagerLookup()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t thread_cnt = 16;
+    const size_t cnt = 1000000;
+    // 用只输出INFO以上等级的日志器替换默认日志器, DEBUG宏只包含查询和等级判断
+    std::unique_ptr<GlobalLoggerBuilder> builder(new GlobalLoggerBuilder());
+    builder->buildLoggerName("root");
+    builder->buildLoggerLevel(LogLevel::Level::INFO);
+    builder->buildOutputType<FileOutput>("./fileout/root.log");
+    builder->build();
+    auto run = [&](const char *name, const std::function<void(size_t)> &call)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < thread_cnt; ++i)
+        {
+            threads.emplace_back([&]
+                                 {
+                for (size_t j = 0; j < cnt; ++j)
+                    call(j); });
+        }
+        for (auto &t : threads)
+            t.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        double sec = std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+        std::cout << name << ": " << thread_cnt << "个线程共" << thread_cnt * cnt << "次, 耗时" << sec << "s, "
+                  << thread_cnt * cnt / sec << "次/s" << std::endl;
+    };
+    run("DEBUG宏(等级不满足)", [](size_t j)
+        { DEBUG("%zu", j); });
+    run("getRootLoggerRaw", [](size_t)
+        { LoggerManager::getLoggerManager()->getRootLoggerRaw()->enabled(LogLevel::Level::DEBUG); });
+    run("getLogger", [](size_t)
+        { LoggerManager::getLoggerManager()->getLogger("root"); });
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 对比格式化项链(虚函数+stringstream)和编译后的指令对默认格式的格式化耗时
+void testFormatter()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t cnt = 1000000;
+    std::string payload(20, 'a');
+    LogMessage msg(LogLevel::Level::INFO, __LINE__, __FILE__, "root", payload);
+    Formatter fmt("[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n");
+    size_t total = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < cnt; ++i)
+    {
+        std::stringstream ss;
+        fmt.format(ss, msg);
+        total += ss.str().size();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double item_ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count() / cnt;
+    char buf[4096];
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < cnt; ++i)
+    {
+        total += fmt.format(buf, sizeof(buf), msg);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double op_ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count() / cnt;
+    std::cout << "格式化" << cnt << "条日志(" << total / cnt / 2 << "字节/条)" << std::endl;
+    std::cout << "\t格式化项链: " << item_ns << " ns/条" << std::endl;
+    std::cout << "\t编译指令:   " << op_ns << " ns/条" << std::endl;
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 测量不同时钟源在调用线程读取时间戳的开销, 以及转换为墙上时间的开销
+void testClock()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t cnt = 10000000;
+    const char *names[] = {"CLOCK_REALTIME", "CLOCK_REALTIME_COARSE", "CLOCK_MONOTONIC", "TSC"};
+    Util::ClockSource srcs[] = {Util::CLOCK_SOURCE_REALTIME, Util::CLOCK_SOURCE_REALTIME_COARSE,
+                                Util::CLOCK_SOURCE_MONOTONIC, Util::CLOCK_SOURCE_TSC};
+    Util::ClockSource old = Util::Clock::getSource();
+    for (int i = 0; i < 4; ++i)
+    {
+        Util::Clock::setSource(srcs[i]);
+        uint64_t sum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t j = 0; j < cnt; ++j)
+        {
+            sum += Util::Clock::tick(srcs[i]);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double tick_ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count() / cnt;
+        size_t sec = 0, nsec = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t j = 0; j < cnt; ++j)
+        {
+            Util::Clock::toWall(srcs[i], sum + j, sec, nsec);
+            sum += nsec;
+        }
+        end = std::chrono::high_resolution_clock::now();
+        double wall_ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count() / cnt;
+        std::cout << names[i] << ": 读取 " << tick_ns << " ns/次, 转换为墙上时间 " << wall_ns << " ns/次" << std::endl;
+    }
+    Util::Clock::setSource(old);
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 对比ofstream文件输出, 文件描述符输出, io_uring输出和内存映射输出的吞吐量, 数据按异步线程的方式以缓冲区的数据段交给输出
+void testOutputSink()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t total = 256 * 1024 * 1024;
+    Buffer buff;
+    std::string line(99, 'a');
+    line += '\n';
+    while (buff.readableSize() < BUFFER_DEFAULT_SIZE)
+        buff.push(line.data(), line.size());
+    std::vector<struct iovec> iov;
+    buff.segments(iov);
+    const char *names[] = {"FileOutput", "RollOutput", "FdOutput", "FdOutput(fallocate)", "UringOutput", "MmapOutput"};
+    Output::ptr outs[] = {OutputFactory::create<FileOutput>("./sinkout/file.log"),
+                          OutputFactory::create<RollOutput>("./sinkout/roll.log", 64 * 1024 * 1024),
+                          OutputFactory::create<FdOutput>("./sinkout/fd.log"),
+                          OutputFactory::create<FdOutput>("./sinkout/fd_prealloc.log", 64 * 1024 * 1024),
+                          OutputFactory::create<UringOutput>("./sinkout/uring.log"),
+                          OutputFactory::create<MmapOutput>("./sinkout/mmap.log")};
+    for (int i = 0; i < 6; ++i)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t written = 0; written < total; written += buff.readableSize())
+            outs[i]->logv(iov.data(), iov.size());
+        outs[i].reset(); // 析构时写出ofstream中剩余的数据, 并等待在途的io_uring请求完成
+        auto end = std::chrono::high_resolution_clock::now();
+        double sec = std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+        std::cout << names[i] << ": " << total / 1024 / 1024 / sec << " MB/s" << std::endl;
+    }
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
+// 滚动时的写入延迟: 在写入线程中关闭旧文件并打开新文件, 对比提前在后台打开下一个文件并在后台关闭旧文件
+// 按照RollOutput的滚动条件推算出哪些写入触发了滚动, 分别统计触发滚动的写入和普通写入的延迟
+void testRotateLatency()
+{
+    std::cout << "--------------------------------------------------" << std::endl;
+    const size_t total = 64 * 1024 * 1024;
+    const size_t max_size = 1024 * 1024;
+    std::string block(4096, 'a');
+    block.back() = '\n';
+    const char *names[] = {"同步滚动", "提前打开", "提前打开+关闭时同步"};
+    for (int i = 0; i < 3; ++i)
+    {
+        RollOutput::ptr out = std::make_shared<RollOutput>("./rotateout/" + std::to_string(i) + "/roll-", max_size);
+        if (i > 0)
+            out->setPreopen(i == 2);
+        std::vector<double> normal, rotate;
+        size_t cur = 0;
+        for (size_t written = 0; written < total; written += block.size())
+        {
+            bool rotating = written == 0 || cur > max_size;
+            if (rotating)
+                cur = 0;
+            cur += block.size();
+            auto start = std::chrono::steady_clock::now();
+            out->log(block.data(), block.size());
+            auto end = std::chrono::steady_clock::now();
+            double us = std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(end - start).count();
+            (rotating ? rotate : normal).push_back(us);
+        }
+        out.reset();
+        // 第一次打开文件时还没有提前打开的文件, 不计入滚动的统计
+        rotate.erase(rotate.begin());
+        std::sort(normal.begin(), normal.end());
+        std::sort(rotate.begin(), rotate.end());
+        double sum = 0;
+        for (double v : rotate)
+            sum += v;
+        std::cout << names[i] << ": 滚动" << rotate.size() << "次, 滚动时平均" << sum / rotate.size()
+                  << "us, 最大" << rotate.back() << "us; 普通写入p99.9 " << normal[normal.size() * 999 / 1000]
+                  << "us, 最大" << normal.back() << "us" << std::endl;
+    }
+    std::cout << "--------------------------------------------------" << std::endl;
+}
+
 int main()
 {
     testSync();
     //testAsync();
+    //testLockFreeAsync();
+    //testStagingAsync();
+    //testDeferredAsync();
+    //testTypedApi();
+    //testDisabledLevel();
+    //testManagerLookup();
+    //testFormatter();
+    //testClock();
+    //testOutputSink();
+    //testRotateLatency();
     return 0;
 }
\ No newline at end of file